@@ -0,0 +1,303 @@
+#include "connection.hpp"
+#include "syntheticdata.hpp"
+#include "textchannel.hpp"
+
+#include <TelegramQt/Client>
+#include <TelegramQt/DataStorage>
+
+#include <TelepathyQt/BaseChannel>
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/Types>
+
+#include <QLoggingCategory>
+#include <QStandardPaths>
+#include <QTest>
+
+struct BenchmarkFixture
+{
+    Tp::SharedPtr<MorseConnection> connection;
+    SyntheticAccount account;
+    Tp::UIntList contactHandles;
+    QStringList contactIdentifiers;
+    QVector<MorseTextChannelPtr> openChannels;
+};
+
+class MorseConnectionBenchmark : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void getContactAttributes_data();
+    void getContactAttributes();
+    void getContactInfo_data();
+    void getContactInfo();
+    void inspectHandles_data();
+    void inspectHandles();
+    void requestHandles_data();
+    void requestHandles();
+    void updateContactList_data();
+    void updateContactList();
+    void onGotRooms_data();
+    void onGotRooms();
+    void onMessageReceived_data();
+    void onMessageReceived();
+    void ensureTextChannel_data();
+    void ensureTextChannel();
+
+private:
+    void addPeersCountData();
+    BenchmarkFixture *fixture(int peersCount);
+    MorseTextChannelPtr createTextChannel(MorseConnection *connection, const Telegram::Peer &peer);
+
+    QHash<int, BenchmarkFixture *> m_fixtures;
+};
+
+void MorseConnectionBenchmark::initTestCase()
+{
+    QStandardPaths::setTestMode(true);
+    QLoggingCategory::setFilterRules(QStringLiteral("default.debug=false"));
+}
+
+void MorseConnectionBenchmark::cleanupTestCase()
+{
+    qDeleteAll(m_fixtures);
+    m_fixtures.clear();
+}
+
+void MorseConnectionBenchmark::addPeersCountData()
+{
+    QTest::addColumn<int>("peersCount");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+BenchmarkFixture *MorseConnectionBenchmark::fixture(int peersCount)
+{
+    if (m_fixtures.contains(peersCount)) {
+        return m_fixtures.value(peersCount);
+    }
+
+    QVariantMap parameters;
+    parameters[QLatin1String("account")] = QStringLiteral("79000000000");
+    parameters[QLatin1String("enable-authentication")] = false;
+
+    BenchmarkFixture *fixture = new BenchmarkFixture();
+    fixture->connection = Tp::BaseConnection::create<MorseConnection>(QLatin1String("morse"),
+                                                                      QLatin1String("telegram"),
+                                                                      parameters);
+    Telegram::Client::InMemoryDataStorage *storage
+            = qobject_cast<Telegram::Client::InMemoryDataStorage *>(fixture->connection->core()->dataStorage());
+    fixture->account = populateSyntheticData(storage, peersCount, peersCount / 10);
+
+    Tp::DBusError error;
+    for (const Telegram::Peer &peer : fixture->account.users) {
+        fixture->contactIdentifiers.append(peer.toString());
+    }
+    fixture->contactHandles = fixture->connection->requestHandles(Tp::HandleTypeContact, fixture->contactIdentifiers, &error);
+    fixture->connection->setContactList(fixture->account.dialogs());
+
+    m_fixtures.insert(peersCount, fixture);
+    return fixture;
+}
+
+MorseTextChannelPtr MorseConnectionBenchmark::createTextChannel(MorseConnection *connection, const Telegram::Peer &peer)
+{
+    const bool isRoom = connection->peerIsRoom(peer);
+
+    QVariantMap request;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType")] = TP_QT_IFACE_CHANNEL_TYPE_TEXT;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle")] = connection->ensureHandle(peer);
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType")] = isRoom ? Tp::HandleTypeRoom : Tp::HandleTypeContact;
+
+    Tp::DBusError error;
+    Tp::BaseChannelPtr channel = connection->createChannelCB(request, &error);
+    if (!channel) {
+        return MorseTextChannelPtr();
+    }
+    return MorseTextChannelPtr::dynamicCast(channel->interface(TP_QT_IFACE_CHANNEL_TYPE_TEXT));
+}
+
+void MorseConnectionBenchmark::getContactAttributes_data()
+{
+    addPeersCountData();
+}
+
+void MorseConnectionBenchmark::getContactAttributes()
+{
+    QFETCH(int, peersCount);
+    BenchmarkFixture *f = fixture(peersCount);
+
+    const QStringList interfaces = {
+        TP_QT_IFACE_CONNECTION,
+        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST,
+        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO,
+        TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE,
+        TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING,
+        TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS,
+    };
+
+    Tp::DBusError error;
+    Tp::ContactAttributesMap result;
+    QBENCHMARK {
+        result = f->connection->getContactAttributes(f->contactHandles, interfaces, &error);
+    }
+    QCOMPARE(result.count(), f->contactHandles.count());
+}
+
+void MorseConnectionBenchmark::getContactInfo_data()
+{
+    QTest::addColumn<int>("peersCount");
+    QTest::addColumn<bool>("cached");
+    QTest::newRow("10k, cold") << 10000 << false;
+    QTest::newRow("10k, cached") << 10000 << true;
+}
+
+void MorseConnectionBenchmark::getContactInfo()
+{
+    QFETCH(int, peersCount);
+    QFETCH(bool, cached);
+    BenchmarkFixture *f = fixture(peersCount);
+
+    Tp::DBusError error;
+    Tp::ContactInfoMap result;
+    QBENCHMARK {
+        if (!cached) {
+            f->connection->invalidateUserInfo(0);
+        }
+        result = f->connection->getContactInfo(f->contactHandles, &error);
+    }
+    QCOMPARE(result.count(), f->contactHandles.count());
+}
+
+void MorseConnectionBenchmark::inspectHandles_data()
+{
+    addPeersCountData();
+}
+
+void MorseConnectionBenchmark::inspectHandles()
+{
+    QFETCH(int, peersCount);
+    BenchmarkFixture *f = fixture(peersCount);
+
+    Tp::DBusError error;
+    QStringList result;
+    QBENCHMARK {
+        result = f->connection->inspectHandles(Tp::HandleTypeContact, f->contactHandles, &error);
+    }
+    QCOMPARE(result, f->contactIdentifiers);
+}
+
+void MorseConnectionBenchmark::requestHandles_data()
+{
+    addPeersCountData();
+}
+
+void MorseConnectionBenchmark::requestHandles()
+{
+    QFETCH(int, peersCount);
+    BenchmarkFixture *f = fixture(peersCount);
+
+    Tp::DBusError error;
+    Tp::UIntList result;
+    QBENCHMARK {
+        result = f->connection->requestHandles(Tp::HandleTypeContact, f->contactIdentifiers, &error);
+    }
+    QCOMPARE(result, f->contactHandles);
+}
+
+void MorseConnectionBenchmark::updateContactList_data()
+{
+    addPeersCountData();
+}
+
+void MorseConnectionBenchmark::updateContactList()
+{
+    QFETCH(int, peersCount);
+    BenchmarkFixture *f = fixture(peersCount);
+
+    const QVector<Telegram::Peer> dialogs = f->account.dialogs();
+    QBENCHMARK {
+        f->connection->setContactList(dialogs);
+    }
+}
+
+void MorseConnectionBenchmark::onGotRooms_data()
+{
+    addPeersCountData();
+}
+
+void MorseConnectionBenchmark::onGotRooms()
+{
+    QFETCH(int, peersCount);
+    BenchmarkFixture *f = fixture(peersCount);
+
+    // The whole listing, chunk by chunk; the room summaries are cached after the first run
+    f->connection->createRoomListChannel();
+    QBENCHMARK {
+        Tp::DBusError error;
+        f->connection->roomListStartListing(&error);
+        while (!f->connection->m_roomListQueue.isEmpty()) {
+            f->connection->onGotRooms();
+        }
+    }
+}
+
+void MorseConnectionBenchmark::onMessageReceived_data()
+{
+    addPeersCountData();
+}
+
+void MorseConnectionBenchmark::onMessageReceived()
+{
+    QFETCH(int, peersCount);
+    BenchmarkFixture *f = fixture(peersCount);
+
+    // A group message from a sender at the end of the handle table is the worst case for the sender lookup
+    const Telegram::Peer room = f->account.rooms.first();
+    const quint32 senderId = f->account.users.last().id;
+    MorseTextChannelPtr textChannel = createTextChannel(f->connection.data(), room);
+    QVERIFY(textChannel);
+
+    Telegram::Client::InMemoryDataStorage *storage
+            = qobject_cast<Telegram::Client::InMemoryDataStorage *>(f->connection->core()->dataStorage());
+    const quint32 messageId = addSyntheticMessage(storage, room, senderId, QStringLiteral("Benchmark message"));
+    Telegram::Message message;
+    QVERIFY(storage->getMessage(&message, room, messageId));
+
+    QBENCHMARK {
+        textChannel->onMessageReceived(message);
+    }
+}
+
+void MorseConnectionBenchmark::ensureTextChannel_data()
+{
+    QTest::addColumn<int>("channelsCount");
+    QTest::newRow("1 channel") << 1;
+    QTest::newRow("500 channels") << 500;
+}
+
+void MorseConnectionBenchmark::ensureTextChannel()
+{
+    QFETCH(int, channelsCount);
+    BenchmarkFixture *f = fixture(1000);
+
+    // The channel lookup done for every received and sent message; one iteration is one message
+    while (f->openChannels.count() < channelsCount) {
+        const Telegram::Peer peer = f->account.users.at(f->openChannels.count());
+        MorseTextChannelPtr textChannel = createTextChannel(f->connection.data(), peer);
+        QVERIFY(textChannel);
+        f->openChannels.append(textChannel);
+    }
+    const Telegram::Peer peer = f->account.users.at(channelsCount - 1);
+
+    QBENCHMARK {
+        f->connection->ensureTextChannel(peer);
+    }
+}
+
+QTEST_GUILESS_MAIN(MorseConnectionBenchmark)
+
+#include "connectionbenchmark.moc"
@@ -0,0 +1,426 @@
+#include "dbusloadtest.hpp"
+
+#include <TelepathyQt/Constants>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDebug>
+#include <QFile>
+#include <QProcess>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+
+static const QString c_busName = QLatin1String("morse-loadtest");
+static const QString c_cmBusName = TP_QT_CONNECTION_MANAGER_BUS_NAME_BASE + QLatin1String("morse");
+static const QString c_cmObjectPath = TP_QT_CONNECTION_MANAGER_OBJECT_PATH_BASE + QLatin1String("morse");
+
+static const QString c_getContactAttributes = QLatin1String("GetContactAttributes");
+static const QString c_inspectHandles = QLatin1String("InspectHandles");
+static const QString c_requestAvatars = QLatin1String("RequestAvatars");
+static const QString c_ensureChannel = QLatin1String("EnsureChannel");
+
+static const char *c_busConfigTemplate =
+        "<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+        " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+        "<busconfig>\n"
+        "  <type>session</type>\n"
+        "  <listen>unix:tmpdir=%1</listen>\n"
+        "  <servicedir>%1</servicedir>\n"
+        "  <policy context=\"default\">\n"
+        "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+        "    <allow eavesdrop=\"true\"/>\n"
+        "    <allow own=\"*\"/>\n"
+        "  </policy>\n"
+        "</busconfig>\n";
+
+static const char *c_serviceFileTemplate =
+        "[D-BUS Service]\n"
+        "Name=%1\n"
+        "Exec=%2\n";
+
+MorseDBusLoadTest::MorseDBusLoadTest(const DBusLoadTestConfig &config, QObject *parent) :
+    QObject(parent),
+    m_config(config),
+    m_bus(c_busName)
+{
+    for (const QPair<QString, int> &entry : m_config.pattern) {
+        MethodStats stats;
+        stats.name = entry.first;
+        stats.weight = entry.second;
+        m_methods.append(stats);
+        m_totalWeight += entry.second;
+    }
+}
+
+MorseDBusLoadTest::~MorseDBusLoadTest()
+{
+    QDBusConnection::disconnectFromBus(c_busName);
+    if (m_busProcess) {
+        // The activated connection manager exits with the bus
+        m_busProcess->terminate();
+        m_busProcess->waitForFinished();
+    }
+}
+
+QVector<QPair<QString, int>> MorseDBusLoadTest::parsePattern(const QString &pattern)
+{
+    static const QStringList knownMethods = {
+        c_getContactAttributes,
+        c_inspectHandles,
+        c_requestAvatars,
+        c_ensureChannel,
+    };
+
+    QVector<QPair<QString, int>> result;
+    for (const QString &entry : pattern.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const QStringList parts = entry.split(QLatin1Char(':'));
+        const QString method = parts.first().trimmed();
+        if (!knownMethods.contains(method)) {
+            qWarning() << "Unknown method" << method << "in the call pattern";
+            return QVector<QPair<QString, int>>();
+        }
+        const int weight = parts.count() > 1 ? parts.at(1).toInt() : 1;
+        if (weight > 0) {
+            result.append({ method, weight });
+        }
+    }
+    return result;
+}
+
+bool MorseDBusLoadTest::start()
+{
+    if (m_methods.isEmpty()) {
+        qCritical() << "The call pattern is empty";
+        return false;
+    }
+    if (!startBus()) {
+        qCritical() << "Unable to start the private bus";
+        return false;
+    }
+    if (!requestConnection()) {
+        qCritical() << "Unable to request a connection";
+        return false;
+    }
+    if (!prepareHandles()) {
+        qCritical() << "Unable to prepare contact handles";
+        return false;
+    }
+    subscribeToSignals();
+
+    m_elapsed.start();
+    for (int i = 0; i < m_config.concurrency; ++i) {
+        issueCall();
+    }
+    QTimer::singleShot(m_config.duration * 1000, this, &MorseDBusLoadTest::finish);
+
+    return true;
+}
+
+bool MorseDBusLoadTest::startBus()
+{
+    if (!m_busDirectory.isValid()) {
+        return false;
+    }
+    const QString directory = m_busDirectory.path();
+
+    QFile serviceFile(directory + QLatin1Char('/') + c_cmBusName + QLatin1String(".service"));
+    if (!serviceFile.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    serviceFile.write(QString::fromLatin1(c_serviceFileTemplate).arg(c_cmBusName, m_config.cmExecutable).toUtf8());
+    serviceFile.close();
+
+    const QString configFileName = directory + QLatin1String("/bus.conf");
+    QFile configFile(configFileName);
+    if (!configFile.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    configFile.write(QString::fromLatin1(c_busConfigTemplate).arg(directory).toUtf8());
+    configFile.close();
+
+    // Keep the activated connection manager away from the real account data
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert(QStringLiteral("XDG_DATA_HOME"), directory + QLatin1String("/data"));
+    environment.insert(QStringLiteral("XDG_CONFIG_HOME"), directory + QLatin1String("/config"));
+
+    m_busProcess = new QProcess(this);
+    m_busProcess->setProcessEnvironment(environment);
+    m_busProcess->start(QStringLiteral("dbus-daemon"), {
+                            QStringLiteral("--config-file=") + configFileName,
+                            QStringLiteral("--nofork"),
+                            QStringLiteral("--print-address"),
+                        });
+    if (!m_busProcess->waitForStarted() || !m_busProcess->waitForReadyRead()) {
+        return false;
+    }
+
+    const QString address = QString::fromLatin1(m_busProcess->readLine()).trimmed();
+    m_bus = QDBusConnection::connectToBus(address, c_busName);
+    return m_bus.isConnected();
+}
+
+bool MorseDBusLoadTest::requestConnection()
+{
+    QDBusMessage request = QDBusMessage::createMethodCall(c_cmBusName, c_cmObjectPath,
+                                                          TP_QT_IFACE_CONNECTION_MANAGER,
+                                                          QStringLiteral("RequestConnection"));
+    request << QStringLiteral("telegram") << m_config.parameters;
+
+    // The first call activates the connection manager
+    const QDBusMessage reply = m_bus.call(request, QDBus::Block, 30000);
+    if (reply.type() != QDBusMessage::ReplyMessage) {
+        qWarning() << reply.errorName() << reply.errorMessage();
+        return false;
+    }
+    m_connectionBusName = reply.arguments().at(0).toString();
+    m_connectionObjectPath = reply.arguments().at(1).value<QDBusObjectPath>().path();
+
+    if (!m_config.connect) {
+        return true;
+    }
+
+    m_bus.call(QDBusMessage::createMethodCall(m_connectionBusName, m_connectionObjectPath,
+                                              TP_QT_IFACE_CONNECTION, QStringLiteral("Connect")));
+    QElapsedTimer connectionTimer;
+    connectionTimer.start();
+    while (connectionTimer.elapsed() < 30000) {
+        const QDBusMessage statusReply = m_bus.call(QDBusMessage::createMethodCall(m_connectionBusName, m_connectionObjectPath,
+                                                                                   TP_QT_IFACE_CONNECTION, QStringLiteral("GetStatus")));
+        const uint status = statusReply.arguments().value(0).toUInt();
+        if (status == Tp::ConnectionStatusConnected) {
+            QTextStream(stdout) << "Connected in " << connectionTimer.elapsed() << " ms" << endl;
+            return true;
+        }
+        if (status == Tp::ConnectionStatusDisconnected) {
+            return false;
+        }
+        QThread::msleep(100);
+    }
+    return false;
+}
+
+bool MorseDBusLoadTest::prepareHandles()
+{
+    QStringList identifiers;
+    identifiers.reserve(m_config.handlesCount);
+    for (int i = 0; i < m_config.handlesCount; ++i) {
+        identifiers.append(QStringLiteral("user%1").arg(m_config.firstUserId + i));
+    }
+
+    QDBusMessage request = QDBusMessage::createMethodCall(m_connectionBusName, m_connectionObjectPath,
+                                                          TP_QT_IFACE_CONNECTION, QStringLiteral("RequestHandles"));
+    request << static_cast<uint>(Tp::HandleTypeContact) << identifiers;
+    QDBusPendingReply<Tp::UIntList> reply = m_bus.asyncCall(request, 60000);
+    reply.waitForFinished();
+    if (reply.isError()) {
+        qWarning() << reply.error().name() << reply.error().message();
+        return false;
+    }
+    m_handles = reply.value();
+    return !m_handles.isEmpty();
+}
+
+void MorseDBusLoadTest::subscribeToSignals()
+{
+    static const QVector<QPair<QString, QString>> signalList = {
+        { TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING, QStringLiteral("AliasesChanged") },
+        { TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS, QStringLiteral("AvatarRetrieved") },
+        { TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS, QStringLiteral("AvatarUpdated") },
+        { TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST, QStringLiteral("ContactsChangedWithID") },
+        { TP_QT_IFACE_CONNECTION_INTERFACE_REQUESTS, QStringLiteral("NewChannels") },
+        { TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE, QStringLiteral("PresencesChanged") },
+    };
+
+    for (const QPair<QString, QString> &signal : signalList) {
+        m_bus.connect(m_connectionBusName, m_connectionObjectPath, signal.first, signal.second,
+                      this, SLOT(onSignalReceived(QDBusMessage)));
+    }
+}
+
+Tp::UIntList MorseDBusLoadTest::nextBatch()
+{
+    Tp::UIntList batch;
+    batch.reserve(m_config.batchSize);
+    for (int i = 0; i < m_config.batchSize; ++i) {
+        batch.append(m_handles.at(m_nextHandle));
+        m_nextHandle = (m_nextHandle + 1) % m_handles.count();
+    }
+    return batch;
+}
+
+QDBusMessage MorseDBusLoadTest::createCall(const QString &method)
+{
+    if (method == c_getContactAttributes) {
+        static const QStringList interfaces = {
+            TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST,
+            TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE,
+            TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING,
+            TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS,
+        };
+        QDBusMessage call = QDBusMessage::createMethodCall(m_connectionBusName, m_connectionObjectPath,
+                                                           TP_QT_IFACE_CONNECTION_INTERFACE_CONTACTS, method);
+        call << QVariant::fromValue(nextBatch()) << interfaces << false;
+        return call;
+    }
+    if (method == c_inspectHandles) {
+        QDBusMessage call = QDBusMessage::createMethodCall(m_connectionBusName, m_connectionObjectPath,
+                                                           TP_QT_IFACE_CONNECTION, method);
+        call << static_cast<uint>(Tp::HandleTypeContact) << QVariant::fromValue(nextBatch());
+        return call;
+    }
+    if (method == c_requestAvatars) {
+        QDBusMessage call = QDBusMessage::createMethodCall(m_connectionBusName, m_connectionObjectPath,
+                                                           TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS, method);
+        call << QVariant::fromValue(nextBatch());
+        return call;
+    }
+
+    // EnsureChannel
+    const uint handle = m_handles.at(m_nextHandle);
+    m_nextHandle = (m_nextHandle + 1) % m_handles.count();
+
+    QVariantMap request;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType")] = TP_QT_IFACE_CHANNEL_TYPE_TEXT;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType")] = static_cast<uint>(Tp::HandleTypeContact);
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle")] = handle;
+    QDBusMessage call = QDBusMessage::createMethodCall(m_connectionBusName, m_connectionObjectPath,
+                                                       TP_QT_IFACE_CONNECTION_INTERFACE_REQUESTS, method);
+    call << request;
+    return call;
+}
+
+void MorseDBusLoadTest::issueCall()
+{
+    // Weighted round robin over the call pattern
+    int slot = m_callCounter++ % m_totalWeight;
+    int methodIndex = 0;
+    while (slot >= m_methods.at(methodIndex).weight) {
+        slot -= m_methods.at(methodIndex).weight;
+        ++methodIndex;
+    }
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_bus.asyncCall(createCall(m_methods.at(methodIndex).name)), this);
+    watcher->setProperty("methodIndex", methodIndex);
+    watcher->setProperty("startedAt", m_elapsed.nsecsElapsed());
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, &MorseDBusLoadTest::onCallFinished);
+    ++m_callsInFlight;
+}
+
+void MorseDBusLoadTest::onCallFinished(QDBusPendingCallWatcher *watcher)
+{
+    watcher->deleteLater();
+    --m_callsInFlight;
+
+    MethodStats &stats = m_methods[watcher->property("methodIndex").toInt()];
+    if (watcher->isError()) {
+        ++stats.errors;
+    } else {
+        const qint64 startedAt = watcher->property("startedAt").toLongLong();
+        stats.latencies.append((m_elapsed.nsecsElapsed() - startedAt) / 1000);
+    }
+
+    if (!m_finishing) {
+        issueCall();
+    }
+}
+
+void MorseDBusLoadTest::onSignalReceived(const QDBusMessage &message)
+{
+    Q_UNUSED(message)
+    ++m_signalsReceived;
+}
+
+void MorseDBusLoadTest::finish()
+{
+    m_finishing = true;
+    const double seconds = m_elapsed.elapsed() / 1000.0;
+
+    QTextStream out(stdout);
+    out << "Duration: " << seconds << " s, concurrency: " << m_config.concurrency
+        << ", batch size: " << m_config.batchSize << ", handles: " << m_handles.count() << endl;
+
+    for (MethodStats &stats : m_methods) {
+        std::sort(stats.latencies.begin(), stats.latencies.end());
+        auto percentile = [&stats](double p) -> qint64 {
+            if (stats.latencies.isEmpty()) {
+                return 0;
+            }
+            const int index = static_cast<int>(std::ceil(p * stats.latencies.count())) - 1;
+            return stats.latencies.at(qBound(0, index, stats.latencies.count() - 1));
+        };
+        out << stats.name << ": " << stats.latencies.count() << " calls"
+            << " (" << (stats.latencies.count() / seconds) << "/s), " << stats.errors << " errors"
+            << ", p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us" << endl;
+    }
+    out << "Signals: " << m_signalsReceived << " (" << (m_signalsReceived / seconds) << "/s)" << endl;
+
+    emit finished();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QLatin1String("morse-dbus-loadtest"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Telepathy client load generator for Morse on a private bus"));
+    parser.addHelpOption();
+    const QCommandLineOption cmOption(QStringLiteral("cm"), QStringLiteral("Path to the telepathy-morse executable."), QStringLiteral("file"));
+    const QCommandLineOption accountOption(QStringLiteral("account"), QStringLiteral("Account phone number."), QStringLiteral("phone"), QStringLiteral("79000000000"));
+    const QCommandLineOption parameterOption(QStringLiteral("parameter"), QStringLiteral("Extra connection parameter."), QStringLiteral("name=value"));
+    const QCommandLineOption patternOption(QStringLiteral("pattern"), QStringLiteral("Call pattern, e.g. GetContactAttributes:5,InspectHandles:2,RequestAvatars:1,EnsureChannel:1."),
+                                           QStringLiteral("pattern"), QStringLiteral("GetContactAttributes:5,InspectHandles:2,RequestAvatars:1,EnsureChannel:1"));
+    const QCommandLineOption concurrencyOption(QStringLiteral("concurrency"), QStringLiteral("Calls in flight."), QStringLiteral("count"), QStringLiteral("32"));
+    const QCommandLineOption batchOption(QStringLiteral("batch"), QStringLiteral("Handles per call."), QStringLiteral("count"), QStringLiteral("100"));
+    const QCommandLineOption handlesOption(QStringLiteral("handles"), QStringLiteral("Number of contact handles to request."), QStringLiteral("count"), QStringLiteral("10000"));
+    const QCommandLineOption firstUserOption(QStringLiteral("first-user-id"), QStringLiteral("Telegram id of the first contact."), QStringLiteral("id"), QStringLiteral("1000000"));
+    const QCommandLineOption durationOption(QStringLiteral("duration"), QStringLiteral("Test duration in seconds."), QStringLiteral("seconds"), QStringLiteral("30"));
+    const QCommandLineOption connectOption(QStringLiteral("connect"), QStringLiteral("Connect the connection before the load (requires a reachable server)."));
+    parser.addOptions({ cmOption, accountOption, parameterOption, patternOption, concurrencyOption,
+                        batchOption, handlesOption, firstUserOption, durationOption, connectOption });
+    parser.process(app);
+
+    if (!parser.isSet(cmOption)) {
+        qCritical() << "The connection manager executable is required (see --cm)";
+        return 1;
+    }
+
+    DBusLoadTestConfig config;
+    config.cmExecutable = parser.value(cmOption);
+    config.parameters[QLatin1String("account")] = parser.value(accountOption);
+    config.parameters[QLatin1String("enable-authentication")] = false;
+    for (const QString &parameter : parser.values(parameterOption)) {
+        const int separator = parameter.indexOf(QLatin1Char('='));
+        if (separator < 0) {
+            continue;
+        }
+        const QString value = parameter.mid(separator + 1);
+        bool isNumber = false;
+        const uint number = value.toUInt(&isNumber);
+        config.parameters[parameter.left(separator)] = isNumber ? QVariant(number) : QVariant(value);
+    }
+    config.pattern = MorseDBusLoadTest::parsePattern(parser.value(patternOption));
+    config.concurrency = qMax(1, parser.value(concurrencyOption).toInt());
+    config.batchSize = qMax(1, parser.value(batchOption).toInt());
+    config.handlesCount = qMax(1, parser.value(handlesOption).toInt());
+    config.firstUserId = parser.value(firstUserOption).toUInt();
+    config.duration = parser.value(durationOption).toInt();
+    config.connect = parser.isSet(connectOption);
+
+    Tp::registerTypes();
+
+    MorseDBusLoadTest loadTest(config);
+    QObject::connect(&loadTest, &MorseDBusLoadTest::finished, &app, &QCoreApplication::quit);
+    if (!loadTest.start()) {
+        return 2;
+    }
+
+    return app.exec();
+}
@@ -0,0 +1,86 @@
+#ifndef MORSE_DBUS_LOAD_TEST_HPP
+#define MORSE_DBUS_LOAD_TEST_HPP
+
+#include <QDBusConnection>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTemporaryDir>
+#include <QVariantMap>
+#include <QVector>
+
+#include <TelepathyQt/Types>
+
+class QDBusMessage;
+class QDBusPendingCallWatcher;
+class QProcess;
+
+struct DBusLoadTestConfig
+{
+    QString cmExecutable;
+    QVariantMap parameters;
+    QVector<QPair<QString, int>> pattern; // Method name and its weight
+    int concurrency = 32;
+    int batchSize = 100;
+    int handlesCount = 10000;
+    quint32 firstUserId = 1000000;
+    int duration = 30; // Seconds
+    bool connect = false;
+};
+
+class MorseDBusLoadTest : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MorseDBusLoadTest(const DBusLoadTestConfig &config, QObject *parent = nullptr);
+    ~MorseDBusLoadTest() override;
+
+    bool start();
+
+    static QVector<QPair<QString, int>> parsePattern(const QString &pattern);
+
+signals:
+    void finished();
+
+protected slots:
+    void onCallFinished(QDBusPendingCallWatcher *watcher);
+    void onSignalReceived(const QDBusMessage &message);
+    void finish();
+
+protected:
+    struct MethodStats
+    {
+        QString name;
+        int weight = 0;
+        quint64 errors = 0;
+        QVector<qint64> latencies; // Microseconds
+    };
+
+    bool startBus();
+    bool requestConnection();
+    bool prepareHandles();
+    void subscribeToSignals();
+    void issueCall();
+    QDBusMessage createCall(const QString &method);
+    Tp::UIntList nextBatch();
+
+    DBusLoadTestConfig m_config;
+    QTemporaryDir m_busDirectory;
+    QProcess *m_busProcess = nullptr;
+    QDBusConnection m_bus;
+
+    QString m_connectionBusName;
+    QString m_connectionObjectPath;
+    Tp::UIntList m_handles;
+    int m_nextHandle = 0;
+
+    QVector<MethodStats> m_methods;
+    int m_totalWeight = 0;
+    int m_callCounter = 0;
+    int m_callsInFlight = 0;
+    bool m_finishing = false;
+
+    quint64 m_signalsReceived = 0;
+    QElapsedTimer m_elapsed;
+};
+
+#endif // MORSE_DBUS_LOAD_TEST_HPP
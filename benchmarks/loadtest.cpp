@@ -0,0 +1,739 @@
+#include "loadtest.hpp"
+
+#include "clientbridge.hpp"
+#include "clientthreadpool.hpp"
+#include "connection.hpp"
+#include "info.hpp"
+
+#include <TelegramQt/AccountApi>
+#include <TelegramQt/AccountStorage>
+#include <TelegramQt/AppInformation>
+#include <TelegramQt/AuthOperation>
+#include <TelegramQt/Client>
+#include <TelegramQt/ClientSettings>
+#include <TelegramQt/ConnectionApi>
+#include <TelegramQt/ContactsApi>
+#include <TelegramQt/DataStorage>
+#include <TelegramQt/MessagingApi>
+#include <TelegramQt/PendingOperation>
+#include <TelegramQt/RsaKey>
+
+#include <TelegramServer/AuthorizationProvider.hpp>
+#include <TelegramServer/LocalCluster.hpp>
+#include <TelegramServer/TelegramServerUser.hpp>
+
+#include <TelepathyQt/Types>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QHostAddress>
+#include <QSemaphore>
+#include <QStandardPaths>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+
+#include <unistd.h>
+
+static const QString c_localAddress = QLatin1String("127.0.0.1");
+static const QString c_authCode = QLatin1String("11111");
+static const QString c_messagePrefix = QLatin1String("loadtest:");
+static const int c_trafficTickInterval = 10; // ms
+static const int c_probeInterval = 20; // ms
+
+using namespace Telegram;
+
+class LoadTestAuthProvider : public Server::Authorization::DefaultProvider
+{
+protected:
+    Server::Authorization::Code generateCode(Server::Session *session, const QString &identifier) override
+    {
+        // A fixed code lets the harness sign in all the users without any side channel
+        Server::Authorization::Code code = DefaultProvider::generateCode(session, identifier);
+        code.code = c_authCode;
+        return code;
+    }
+};
+
+static LoadTestAuthProvider s_authProvider;
+
+LoadTestDropProxy::LoadTestDropProxy(quint16 targetPort, QObject *parent) :
+    QTcpServer(parent),
+    m_targetPort(targetPort),
+    m_dropTimer(new QTimer(this))
+{
+    connect(m_dropTimer, &QTimer::timeout, this, &LoadTestDropProxy::dropConnections);
+}
+
+void LoadTestDropProxy::setDropInterval(int msec)
+{
+    if (msec > 0) {
+        m_dropTimer->start(msec);
+    } else {
+        m_dropTimer->stop();
+    }
+}
+
+void LoadTestDropProxy::dropConnections()
+{
+    // Aborting a socket closes its linked one as well
+    const QVector<QTcpSocket *> sockets = m_sockets;
+    for (QTcpSocket *socket : sockets) {
+        socket->abort();
+    }
+}
+
+void LoadTestDropProxy::incomingConnection(qintptr socketDescriptor)
+{
+    QTcpSocket *client = new QTcpSocket(this);
+    client->setSocketDescriptor(socketDescriptor);
+    QTcpSocket *server = new QTcpSocket(this);
+    // The data written while connecting is buffered by the socket
+    server->connectToHost(c_localAddress, m_targetPort);
+    m_sockets << client << server;
+
+    connect(client, &QTcpSocket::readyRead, server, [client, server]() {
+        server->write(client->readAll());
+    });
+    connect(server, &QTcpSocket::readyRead, client, [client, server]() {
+        client->write(server->readAll());
+    });
+    for (QTcpSocket *socket : { client, server }) {
+        connect(socket, &QTcpSocket::disconnected, this, [this, client, server]() {
+            for (QTcpSocket *linked : { client, server }) {
+                m_sockets.removeOne(linked);
+                linked->abort();
+                linked->deleteLater();
+            }
+        });
+    }
+}
+
+MorseLoadTest::MorseLoadTest(const LoadTestConfig &config, QObject *parent) :
+    QObject(parent),
+    m_config(config)
+{
+}
+
+MorseLoadTest::~MorseLoadTest()
+{
+    m_morseConnections.clear();
+    if (m_proxy) {
+        m_proxy->deleteLater();
+    }
+    if (m_driversThread) {
+        for (Client::Client *driver : m_drivers) {
+            driver->deleteLater();
+        }
+        m_driversThread->quit();
+        m_driversThread->wait();
+    }
+    if (m_serverThread) {
+        m_serverThread->quit();
+        m_serverThread->wait();
+    }
+    delete m_cluster;
+}
+
+bool MorseLoadTest::start()
+{
+    m_initialMemoryUsage = currentMemoryUsage();
+
+    if (!startServer()) {
+        qCritical() << "Unable to start the local server";
+        return false;
+    }
+    if ((m_config.dropInterval > 0) && !startProxy()) {
+        qCritical() << "Unable to start the dropping proxy";
+        return false;
+    }
+    if (!prepareMorseAccounts()) {
+        qCritical() << "Unable to prepare the Morse accounts";
+        return false;
+    }
+    if (!prepareDrivers()) {
+        qCritical() << "Unable to prepare the traffic drivers";
+        return false;
+    }
+    if (!startMorseConnections()) {
+        qCritical() << "Unable to start the Morse connections";
+        return false;
+    }
+
+    m_messageTimer = new QTimer(this);
+    m_messageTimer->setInterval(c_trafficTickInterval);
+    connect(m_messageTimer, &QTimer::timeout, this, &MorseLoadTest::sendNextMessage);
+
+    m_statusTimer = new QTimer(this);
+    m_statusTimer->setInterval(c_trafficTickInterval);
+    connect(m_statusTimer, &QTimer::timeout, this, &MorseLoadTest::sendNextStatus);
+
+    m_probeTimer = new QTimer(this);
+    m_probeTimer->setInterval(c_probeInterval);
+    connect(m_probeTimer, &QTimer::timeout, this, &MorseLoadTest::probeCallLatency);
+
+    if (m_proxy) {
+        const int dropInterval = m_config.dropInterval * 1000;
+        QTimer::singleShot(0, m_proxy, [this, dropInterval]() {
+            m_proxy->setDropInterval(dropInterval);
+        });
+    }
+    m_lossTimes.fill(-1, m_config.accountsCount);
+
+    m_initialCpuTime = morseCpuTime();
+    m_elapsed.start();
+    if (m_config.messageRate > 0) {
+        m_messageTimer->start();
+    }
+    if (m_config.statusRate > 0) {
+        m_statusTimer->start();
+    }
+    m_probeTimer->start();
+    QTimer::singleShot(m_config.duration * 1000, this, &MorseLoadTest::finish);
+
+    return true;
+}
+
+bool MorseLoadTest::startServer()
+{
+    const RsaKey privateKey = RsaKey::fromFile(m_config.serverPrivateKeyFile);
+    if (!privateKey.isValid()) {
+        qCritical() << "Unable to read the server private key from" << m_config.serverPrivateKeyFile;
+        return false;
+    }
+
+    DcOption localServer;
+    localServer.id = 1;
+    localServer.address = c_localAddress;
+    localServer.port = m_config.serverPort;
+    DcConfiguration configuration;
+    configuration.dcOptions = { localServer };
+
+    // The server runs in its own thread to not share the event loop with the measured connection
+    m_serverThread = new QThread(this);
+    m_serverThread->start();
+    m_cluster = new Server::LocalCluster();
+    m_cluster->moveToThread(m_serverThread);
+
+    bool started = false;
+    QSemaphore done;
+    QTimer::singleShot(0, m_cluster, [&]() {
+        m_cluster->setServerPrivateRsaKey(privateKey);
+        m_cluster->setServerConfiguration(configuration);
+        m_cluster->setAuthorizationProvider(&s_authProvider);
+        started = m_cluster->start();
+        if (started) {
+            for (int i = 0; i < m_config.usersCount; ++i) {
+                Server::LocalUser *user = m_cluster->addUser(userPhoneNumber(i), localServer.id);
+                user->setFirstName(QStringLiteral("User"));
+                user->setLastName(QString::number(i));
+            }
+        }
+        done.release();
+    });
+    done.acquire();
+
+    return started;
+}
+
+bool MorseLoadTest::startProxy()
+{
+    // The proxy shares the server thread, so forwarding is not accounted as the Morse CPU time
+    bool started = false;
+    QSemaphore done;
+    QTimer::singleShot(0, m_cluster, [&]() {
+        m_proxy = new LoadTestDropProxy(m_config.serverPort);
+        started = m_proxy->listen(QHostAddress(c_localAddress), m_config.proxyPort);
+        done.release();
+    });
+    done.acquire();
+
+    return started;
+}
+
+bool MorseLoadTest::prepareMorseAccounts()
+{
+    // Sign in the Morse accounts once and store the sessions where MorseConnection will look for them
+    for (int i = 0; i < m_config.accountsCount; ++i) {
+        MorseInfo info;
+        info.setAccountIdentifier(userPhoneNumber(i));
+        info.setServerIdentifier(c_localAddress + QLatin1Char(':') + QString::number(morseServerPort()));
+
+        Client::Client *client = createClient(userPhoneNumber(i), morseServerPort(), info.accountDataFilePath());
+        if (!signIn(client)) {
+            return false;
+        }
+        const Peer morsePeer = Peer::fromUserId(client->contactsApi()->selfUserId());
+        client->accountStorage()->sync();
+        client->connectionApi()->disconnectFromServer();
+        client->deleteLater();
+
+        if (!morsePeer.isValid()) {
+            return false;
+        }
+        m_morsePeers.append(morsePeer);
+    }
+
+    return true;
+}
+
+bool MorseLoadTest::prepareDrivers()
+{
+    const int accountsCount = m_config.accountsCount;
+    const int dialogsCount = qMin(m_config.dialogsCount, m_config.usersCount - accountsCount);
+    const int sendersCount = qMin(m_config.sendersCount, dialogsCount);
+
+    QVector<Client::ContactsApi::ContactInfo> morseContacts;
+    for (int i = 0; i < accountsCount; ++i) {
+        Client::ContactsApi::ContactInfo morseContact;
+        morseContact.phoneNumber = userPhoneNumber(i);
+        morseContact.firstName = QStringLiteral("Morse");
+        morseContact.lastName = QString::number(i);
+        morseContacts.append(morseContact);
+    }
+
+    // Each dialog is started by a message from the corresponding user to every Morse account;
+    // the first sendersCount users stay online and generate the traffic.
+    for (int i = accountsCount; i < accountsCount + dialogsCount; ++i) {
+        Client::Client *client = createClient(userPhoneNumber(i), m_config.serverPort);
+        if (!signIn(client)) {
+            return false;
+        }
+
+        if (!waitFor(client->contactsApi()->importContacts(morseContacts))) {
+            return false;
+        }
+        for (const Peer &morsePeer : m_morsePeers) {
+            client->messagingApi()->sendMessage(morsePeer, QStringLiteral("Hello"));
+        }
+
+        if (m_drivers.count() < sendersCount) {
+            m_drivers.append(client);
+        } else {
+            client->connectionApi()->disconnectFromServer();
+            client->deleteLater();
+        }
+    }
+
+    // The drivers run in their own thread to not be accounted as the Morse CPU time
+    m_driversThread = new QThread(this);
+    m_driversThread->setObjectName(QStringLiteral("LoadTestDrivers"));
+    m_driversThread->start();
+    for (Client::Client *driver : m_drivers) {
+        driver->moveToThread(m_driversThread);
+    }
+
+    return !m_drivers.isEmpty() || (m_config.messageRate <= 0 && m_config.statusRate <= 0);
+}
+
+bool MorseLoadTest::startMorseConnections()
+{
+    if (m_config.clientThreadsCount > 0) {
+        MorseClientThreadPool::instance()->setMaxThreadCount(m_config.clientThreadsCount);
+    }
+
+    QElapsedTimer connectionTimer;
+    connectionTimer.start();
+    const qint64 memoryUsage = currentMemoryUsage();
+
+    for (int i = 0; i < m_config.accountsCount; ++i) {
+        if (!startMorseConnection(i)) {
+            return false;
+        }
+    }
+
+    m_accountsMemoryUsage = currentMemoryUsage() - memoryUsage;
+    QTextStream(stdout) << m_config.accountsCount << " Morse account(s) connected in "
+                        << connectionTimer.elapsed() << " ms" << endl;
+    return true;
+}
+
+bool MorseLoadTest::startMorseConnection(int accountIndex)
+{
+    QVariantMap parameters;
+    parameters[QLatin1String("account")] = userPhoneNumber(accountIndex);
+    parameters[QLatin1String("enable-authentication")] = false;
+    parameters[QLatin1String("server-address")] = c_localAddress;
+    parameters[QLatin1String("server-port")] = static_cast<uint>(morseServerPort());
+    parameters[QLatin1String("server-key")] = m_config.serverPublicKeyFile;
+    parameters[QLatin1String("client-thread")] = m_config.clientThread;
+
+    Tp::SharedPtr<MorseConnection> morseConnection
+            = Tp::BaseConnection::create<MorseConnection>(QLatin1String("morse"),
+                                                          QLatin1String("telegram"),
+                                                          parameters);
+    m_morseConnections.append(morseConnection);
+
+    MorseConnection *connection = morseConnection.data();
+    connect(connection->core()->messagingApi(), &Client::MessagingApi::messageReceived,
+            this, [this, connection](const Peer peer, quint32 messageId) {
+        onMorseMessageReceived(connection, peer, messageId);
+    });
+    connect(connection->core()->connectionApi(), &Client::ConnectionApi::statusChanged,
+            this, [this, accountIndex](Client::ConnectionApi::Status status) {
+        onMorseStatusChanged(accountIndex, status == Client::ConnectionApi::StatusReady);
+    });
+
+    Tp::DBusError error;
+    connection->doConnect(&error);
+    if (error.isValid()) {
+        qCritical() << error.name() << error.message();
+        return false;
+    }
+
+    if (connection->status() == Tp::ConnectionStatusConnecting) {
+        QEventLoop loop;
+        connect(connection, &Tp::BaseConnection::statusChanged, &loop, [&loop](uint status) {
+            if (status != Tp::ConnectionStatusConnecting) {
+                loop.quit();
+            }
+        });
+        QTimer::singleShot(30000, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+
+    if (connection->status() != Tp::ConnectionStatusConnected) {
+        qWarning() << "Account" << accountIndex << "is not connected";
+        return false;
+    }
+    return true;
+}
+
+Client::Client *MorseLoadTest::createClient(const QString &phoneNumber, quint16 serverPort, const QString &accountFileName)
+{
+    // No parent: the drivers are moved to their own thread
+    Client::Client *client = new Client::Client();
+
+    DcOption localServer;
+    localServer.address = c_localAddress;
+    localServer.port = serverPort;
+
+    Client::Settings *settings = new Client::Settings(client);
+    settings->setServerConfiguration({localServer});
+    settings->setServerRsaKey(RsaKey::fromFile(m_config.serverPublicKeyFile));
+    client->setSettings(settings);
+
+    Client::AppInformation *appInfo = new Client::AppInformation(client);
+    appInfo->setAppId(MorseInfo::appId());
+    appInfo->setAppHash(MorseInfo::appHash());
+    appInfo->setAppVersion(MorseInfo::version());
+    appInfo->setDeviceInfo(QLatin1String("loadtest"));
+    appInfo->setOsInfo(QLatin1String("GNU/Linux"));
+    appInfo->setLanguageCode(QLatin1String("en"));
+    client->setAppInformation(appInfo);
+
+    Client::AccountStorage *accountStorage = nullptr;
+    if (accountFileName.isEmpty()) {
+        accountStorage = new Client::AccountStorage(client);
+    } else {
+        Client::FileAccountStorage *fileStorage = new Client::FileAccountStorage(client);
+        fileStorage->setFileName(accountFileName);
+        fileStorage->setAccountIdentifier(phoneNumber);
+        accountStorage = fileStorage;
+    }
+    accountStorage->setPhoneNumber(phoneNumber);
+    client->setAccountStorage(accountStorage);
+    client->setDataStorage(new Client::InMemoryDataStorage(client));
+
+    return client;
+}
+
+bool MorseLoadTest::signIn(Client::Client *client)
+{
+    Client::AuthOperation *authOperation = client->connectionApi()->startAuthentication();
+    authOperation->setPhoneNumber(client->accountStorage()->phoneNumber());
+    connect(authOperation, &Client::AuthOperation::authCodeRequired, authOperation, [authOperation]() {
+        authOperation->submitAuthCode(c_authCode);
+    });
+
+    if (!waitFor(authOperation) || !authOperation->isSucceeded()) {
+        qWarning() << "Sign in failed for" << client->accountStorage()->phoneNumber();
+        return false;
+    }
+
+    if (client->connectionApi()->status() != Client::ConnectionApi::StatusReady) {
+        QEventLoop loop;
+        connect(client->connectionApi(), &Client::ConnectionApi::statusChanged, &loop, &QEventLoop::quit);
+        QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    return client->connectionApi()->status() == Client::ConnectionApi::StatusReady;
+}
+
+bool MorseLoadTest::waitFor(PendingOperation *operation, int timeout)
+{
+    if (!operation->isFinished()) {
+        QEventLoop loop;
+        connect(operation, &PendingOperation::finished, &loop, &QEventLoop::quit);
+        QTimer::singleShot(timeout, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    return operation->isFinished() && operation->isSucceeded();
+}
+
+QString MorseLoadTest::userPhoneNumber(int userIndex) const
+{
+    return QStringLiteral("5550%1").arg(userIndex, 7, 10, QLatin1Char('0'));
+}
+
+quint16 MorseLoadTest::morseServerPort() const
+{
+    return m_config.dropInterval > 0 ? m_config.proxyPort : m_config.serverPort;
+}
+
+qint64 MorseLoadTest::morseCpuTime()
+{
+    // CPU time in ms of the threads running the Morse code: the main one and the client pool
+    const QString tasksPath = QStringLiteral("/proc/self/task");
+    const QString mainThreadId = QString::number(getpid());
+    const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+
+    qint64 ticks = 0;
+    for (const QString &threadId : QDir(tasksPath).entryList(QDir::Dirs|QDir::NoDotAndDotDot)) {
+        QFile statFile(tasksPath + QLatin1Char('/') + threadId + QLatin1String("/stat"));
+        if (!statFile.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        // Format: tid (comm) state ppid ... utime stime ...
+        const QByteArray stat = statFile.readAll();
+        const int nameBegin = stat.indexOf('(');
+        const int nameEnd = stat.lastIndexOf(')');
+        if (nameBegin < 0 || nameEnd < nameBegin) {
+            continue;
+        }
+        const QByteArray name = stat.mid(nameBegin + 1, nameEnd - nameBegin - 1);
+        if ((threadId != mainThreadId) && !name.startsWith("TelegramClient")) {
+            continue;
+        }
+        const QList<QByteArray> fields = stat.mid(nameEnd + 2).split(' ');
+        if (fields.count() > 12) {
+            ticks += fields.at(11).toLongLong() + fields.at(12).toLongLong(); // utime + stime
+        }
+    }
+    return ticksPerSecond > 0 ? ticks * 1000 / ticksPerSecond : 0;
+}
+
+qint64 MorseLoadTest::currentMemoryUsage()
+{
+    // Resident set size in KiB
+    QFile statusFile(QStringLiteral("/proc/self/status"));
+    if (!statusFile.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    const QList<QByteArray> lines = statusFile.readAll().split('\n');
+    for (const QByteArray &line : lines) {
+        if (line.startsWith("VmRSS:")) {
+            return line.mid(6).simplified().split(' ').first().toLongLong();
+        }
+    }
+    return 0;
+}
+
+void MorseLoadTest::onMorseMessageReceived(MorseConnection *connection, const Peer peer, quint32 messageId)
+{
+    Message message;
+    if (!connection->bridge()->getMessage(&message, peer, messageId)) {
+        return;
+    }
+    if (!message.text().startsWith(c_messagePrefix)) {
+        return;
+    }
+    const qint64 sentAt = message.text().mid(c_messagePrefix.size()).toLongLong();
+    m_deliveryLatencies.append(QDateTime::currentMSecsSinceEpoch() - sentAt);
+    ++m_deliveredMessages;
+}
+
+void MorseLoadTest::sendNextMessage()
+{
+    const quint64 expected = static_cast<quint64>(m_config.messageRate * m_elapsed.elapsed() / 1000.0);
+    while (m_sentMessages < expected) {
+        Client::Client *driver = m_drivers.at(m_nextDriver);
+        m_nextDriver = (m_nextDriver + 1) % m_drivers.count();
+        const Peer morsePeer = m_morsePeers.at(m_nextAccount);
+        m_nextAccount = (m_nextAccount + 1) % m_morsePeers.count();
+
+        const QString text = c_messagePrefix + QString::number(QDateTime::currentMSecsSinceEpoch());
+        QTimer::singleShot(0, driver, [driver, morsePeer, text]() {
+            driver->messagingApi()->sendMessage(morsePeer, text);
+        });
+        ++m_sentMessages;
+    }
+}
+
+void MorseLoadTest::sendNextStatus()
+{
+    const quint64 expected = static_cast<quint64>(m_config.statusRate * m_elapsed.elapsed() / 1000.0);
+    while (m_sentStatuses < expected) {
+        Client::Client *driver = m_drivers.at(m_nextStatusDriver);
+        m_nextStatusDriver = (m_nextStatusDriver + 1) % m_drivers.count();
+
+        // Toggle the driver presence to produce contact status updates on the Morse side
+        const bool offline = m_sentStatuses % 2;
+        QTimer::singleShot(0, driver, [driver, offline]() {
+            driver->accountApi()->updateStatus(offline);
+        });
+        ++m_sentStatuses;
+    }
+}
+
+void MorseLoadTest::probeCallLatency()
+{
+    // A D-Bus method call reaches MorseConnection as an event queued to the main thread,
+    // so the time to dispatch a queued call and run a cheap handler is what the clients observe.
+    const qint64 postedAt = m_elapsed.nsecsElapsed();
+    QTimer::singleShot(0, this, [this, postedAt]() {
+        onProbeCall(postedAt);
+    });
+}
+
+void MorseLoadTest::onProbeCall(qint64 postedAt)
+{
+    MorseConnection *connection = m_morseConnections.at(m_nextProbeAccount).data();
+    m_nextProbeAccount = (m_nextProbeAccount + 1) % m_morseConnections.count();
+
+    Tp::DBusError error;
+    connection->getAliases({ connection->selfHandle() }, &error);
+    m_callLatencies.append((m_elapsed.nsecsElapsed() - postedAt) / 1000);
+}
+
+void MorseLoadTest::onMorseStatusChanged(int accountIndex, bool ready)
+{
+    if (!m_elapsed.isValid()) {
+        // The initial connection is measured separately
+        return;
+    }
+    qint64 &lossTime = m_lossTimes[accountIndex];
+    if (!ready) {
+        if (lossTime < 0) {
+            lossTime = m_elapsed.elapsed();
+        }
+        return;
+    }
+    if (lossTime >= 0) {
+        m_resumeLatencies.append(m_elapsed.elapsed() - lossTime);
+        lossTime = -1;
+    }
+}
+
+qint64 MorseLoadTest::percentile(const QVector<qint64> &sortedValues, double p)
+{
+    if (sortedValues.isEmpty()) {
+        return 0;
+    }
+    const int index = qMin(sortedValues.count() - 1,
+                           static_cast<int>(std::ceil(p * sortedValues.count())) - 1);
+    return sortedValues.at(qMax(0, index));
+}
+
+void MorseLoadTest::finish()
+{
+    m_messageTimer->stop();
+    m_statusTimer->stop();
+    m_probeTimer->stop();
+
+    const double seconds = m_elapsed.elapsed() / 1000.0;
+    std::sort(m_deliveryLatencies.begin(), m_deliveryLatencies.end());
+    std::sort(m_callLatencies.begin(), m_callLatencies.end());
+    std::sort(m_resumeLatencies.begin(), m_resumeLatencies.end());
+
+    QTextStream out(stdout);
+    out << "Duration: " << seconds << " s" << endl;
+    out << "Accounts: " << m_config.accountsCount << ", users: " << m_config.usersCount
+        << ", dialogs: " << m_config.dialogsCount << ", senders: " << m_drivers.count() << endl;
+    out << "Messages sent: " << m_sentMessages << ", delivered: " << m_deliveredMessages << endl;
+    out << "Status updates sent: " << m_sentStatuses << endl;
+    out << "Throughput: " << (m_deliveredMessages / seconds) << " messages/s" << endl;
+    out << "Client threads: ";
+    if (m_config.clientThread) {
+        out << MorseClientThreadPool::instance()->threadCount() << endl;
+    } else {
+        out << "no" << endl;
+    }
+    out << "Delivery latency: p50 " << percentile(m_deliveryLatencies, 0.5) << " ms, p99 " << percentile(m_deliveryLatencies, 0.99)
+        << " ms, max " << (m_deliveryLatencies.isEmpty() ? 0 : m_deliveryLatencies.last()) << " ms" << endl;
+    out << "Call latency: p50 " << percentile(m_callLatencies, 0.5) << " us, p99 " << percentile(m_callLatencies, 0.99)
+        << " us, max " << (m_callLatencies.isEmpty() ? 0 : m_callLatencies.last()) << " us" << endl;
+    if (m_config.dropInterval > 0) {
+        out << "Reconnects: " << m_resumeLatencies.count() << " (a drop every " << m_config.dropInterval << " s)" << endl;
+        out << "Resume latency: p50 " << percentile(m_resumeLatencies, 0.5) << " ms, p99 " << percentile(m_resumeLatencies, 0.99)
+            << " ms, max " << (m_resumeLatencies.isEmpty() ? 0 : m_resumeLatencies.last()) << " ms" << endl;
+    }
+    const qint64 memoryUsage = currentMemoryUsage();
+    out << "Memory (RSS): " << memoryUsage << " KiB (+" << (memoryUsage - m_initialMemoryUsage) << " KiB)" << endl;
+    out << "Memory per account: " << (m_accountsMemoryUsage / m_config.accountsCount) << " KiB" << endl;
+    const qint64 cpuTime = morseCpuTime() - m_initialCpuTime;
+    out << "Morse CPU time: " << cpuTime << " ms (" << (cpuTime / seconds / 10.0) << "% of a core), per account: "
+        << (cpuTime / m_config.accountsCount) << " ms" << endl;
+
+    emit finished();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QLatin1String("morse-loadtest"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Morse load test against a local Telegram server"));
+    parser.addHelpOption();
+    const QCommandLineOption accountsOption(QStringLiteral("accounts"), QStringLiteral("Number of Morse accounts."), QStringLiteral("count"), QStringLiteral("1"));
+    const QCommandLineOption usersOption(QStringLiteral("users"), QStringLiteral("Number of server users."), QStringLiteral("count"), QStringLiteral("1000"));
+    const QCommandLineOption dialogsOption(QStringLiteral("dialogs"), QStringLiteral("Number of Morse dialogs."), QStringLiteral("count"), QStringLiteral("100"));
+    const QCommandLineOption sendersOption(QStringLiteral("senders"), QStringLiteral("Number of online traffic generators."), QStringLiteral("count"), QStringLiteral("10"));
+    const QCommandLineOption messageRateOption(QStringLiteral("message-rate"), QStringLiteral("Incoming messages per second."), QStringLiteral("rate"), QStringLiteral("10"));
+    const QCommandLineOption statusRateOption(QStringLiteral("status-rate"), QStringLiteral("Status updates per second."), QStringLiteral("rate"), QStringLiteral("10"));
+    const QCommandLineOption durationOption(QStringLiteral("duration"), QStringLiteral("Test duration in seconds."), QStringLiteral("seconds"), QStringLiteral("60"));
+    const QCommandLineOption portOption(QStringLiteral("port"), QStringLiteral("Local server port."), QStringLiteral("port"), QStringLiteral("11443"));
+    const QCommandLineOption privateKeyOption(QStringLiteral("private-key"), QStringLiteral("Server private RSA key (PEM)."), QStringLiteral("file"));
+    const QCommandLineOption publicKeyOption(QStringLiteral("public-key"), QStringLiteral("Server public RSA key (PEM)."), QStringLiteral("file"));
+    const QCommandLineOption clientThreadOption(QStringLiteral("client-thread"), QStringLiteral("Run the Morse Telegram clients in the worker threads."));
+    const QCommandLineOption clientThreadsOption(QStringLiteral("client-threads"), QStringLiteral("Maximum number of the worker threads."), QStringLiteral("count"), QStringLiteral("0"));
+    const QCommandLineOption dropIntervalOption(QStringLiteral("drop-interval"), QStringLiteral("Drop the Morse connections every given seconds."), QStringLiteral("seconds"), QStringLiteral("0"));
+    const QCommandLineOption proxyPortOption(QStringLiteral("proxy-port"), QStringLiteral("Dropping proxy port."), QStringLiteral("port"), QStringLiteral("11444"));
+    parser.addOptions({ accountsOption, usersOption, dialogsOption, sendersOption, messageRateOption, statusRateOption,
+                        durationOption, portOption, privateKeyOption, publicKeyOption, clientThreadOption, clientThreadsOption,
+                        dropIntervalOption, proxyPortOption });
+    parser.process(app);
+
+    if (!parser.isSet(privateKeyOption) || !parser.isSet(publicKeyOption)) {
+        qCritical() << "The server key pair is required (see --private-key and --public-key)";
+        return 1;
+    }
+
+    LoadTestConfig config;
+    config.accountsCount = qMax(1, parser.value(accountsOption).toInt());
+    config.usersCount = qMax(config.accountsCount + 1, parser.value(usersOption).toInt());
+    config.dialogsCount = parser.value(dialogsOption).toInt();
+    config.sendersCount = qMax(1, parser.value(sendersOption).toInt());
+    config.messageRate = parser.value(messageRateOption).toDouble();
+    config.statusRate = parser.value(statusRateOption).toDouble();
+    config.duration = parser.value(durationOption).toInt();
+    config.serverPort = parser.value(portOption).toUShort();
+    config.serverPrivateKeyFile = parser.value(privateKeyOption);
+    config.serverPublicKeyFile = parser.value(publicKeyOption);
+    config.clientThread = parser.isSet(clientThreadOption);
+    config.clientThreadsCount = parser.value(clientThreadsOption).toInt();
+    config.dropInterval = parser.value(dropIntervalOption).toInt();
+    config.proxyPort = parser.value(proxyPortOption).toUShort();
+
+    QStandardPaths::setTestMode(true);
+    Telegram::initialize();
+    Tp::registerTypes();
+
+    MorseLoadTest loadTest(config);
+    QObject::connect(&loadTest, &MorseLoadTest::finished, &app, &QCoreApplication::quit);
+    if (!loadTest.start()) {
+        return 2;
+    }
+
+    return app.exec();
+}
@@ -0,0 +1,145 @@
+#ifndef MORSE_LOAD_TEST_HPP
+#define MORSE_LOAD_TEST_HPP
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTcpServer>
+#include <QVector>
+
+#include <TelegramQt/TelegramNamespace>
+#include <TelepathyQt/BaseConnection>
+
+class QTcpSocket;
+class QThread;
+class QTimer;
+
+class MorseConnection;
+
+namespace Telegram {
+
+class PendingOperation;
+
+namespace Client {
+
+class Client;
+
+} // Client namespace
+
+namespace Server {
+
+class LocalCluster;
+
+} // Server namespace
+
+} // Telegram namespace
+
+struct LoadTestConfig
+{
+    int accountsCount = 1;
+    int usersCount = 1000;
+    int dialogsCount = 100;
+    int sendersCount = 10;
+    double messageRate = 10; // Messages per second
+    double statusRate = 10; // Status updates per second
+    int duration = 60; // Seconds
+    quint16 serverPort = 11443;
+    QString serverPrivateKeyFile;
+    QString serverPublicKeyFile;
+    bool clientThread = false;
+    int clientThreadsCount = 0; // Zero means the pool default
+    int dropInterval = 0; // Seconds between the Morse connection drops, zero to keep the connections
+    quint16 proxyPort = 11444;
+};
+
+// Forwards the Morse connections to the local server and drops them all on dropConnections()
+class LoadTestDropProxy : public QTcpServer
+{
+    Q_OBJECT
+public:
+    LoadTestDropProxy(quint16 targetPort, QObject *parent = nullptr);
+
+    void setDropInterval(int msec);
+
+public slots:
+    void dropConnections();
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+    quint16 m_targetPort = 0;
+    QTimer *m_dropTimer = nullptr;
+    QVector<QTcpSocket *> m_sockets;
+};
+
+class MorseLoadTest : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MorseLoadTest(const LoadTestConfig &config, QObject *parent = nullptr);
+    ~MorseLoadTest() override;
+
+    bool start();
+
+signals:
+    void finished();
+
+protected slots:
+    void onMorseMessageReceived(MorseConnection *connection, const Telegram::Peer peer, quint32 messageId);
+    void sendNextMessage();
+    void sendNextStatus();
+    void probeCallLatency();
+    void onProbeCall(qint64 postedAt);
+    void onMorseStatusChanged(int accountIndex, bool ready);
+    void finish();
+
+protected:
+    bool startServer();
+    bool startProxy();
+    bool prepareMorseAccounts();
+    bool prepareDrivers();
+    bool startMorseConnections();
+    bool startMorseConnection(int accountIndex);
+
+    Telegram::Client::Client *createClient(const QString &phoneNumber, quint16 serverPort, const QString &accountFileName = QString());
+    bool signIn(Telegram::Client::Client *client);
+    bool waitFor(Telegram::PendingOperation *operation, int timeout = 10000);
+
+    QString userPhoneNumber(int userIndex) const;
+    quint16 morseServerPort() const;
+    static qint64 currentMemoryUsage();
+    static qint64 morseCpuTime();
+    static qint64 percentile(const QVector<qint64> &sortedValues, double p);
+
+    LoadTestConfig m_config;
+
+    QThread *m_serverThread = nullptr;
+    Telegram::Server::LocalCluster *m_cluster = nullptr;
+    LoadTestDropProxy *m_proxy = nullptr; // Lives in the server thread
+
+    QVector<Tp::SharedPtr<MorseConnection>> m_morseConnections;
+    QVector<Telegram::Peer> m_morsePeers;
+    QThread *m_driversThread = nullptr;
+    QVector<Telegram::Client::Client *> m_drivers;
+
+    QTimer *m_messageTimer = nullptr;
+    QTimer *m_statusTimer = nullptr;
+    QTimer *m_probeTimer = nullptr;
+    QElapsedTimer m_elapsed;
+
+    int m_nextDriver = 0;
+    int m_nextAccount = 0;
+    int m_nextStatusDriver = 0;
+    int m_nextProbeAccount = 0;
+    quint64 m_sentMessages = 0;
+    quint64 m_sentStatuses = 0;
+    quint64 m_deliveredMessages = 0;
+    QVector<qint64> m_deliveryLatencies;
+    QVector<qint64> m_callLatencies; // Microseconds
+    QVector<qint64> m_lossTimes; // Per account, when the connection was lost or -1
+    QVector<qint64> m_resumeLatencies; // From the connection loss to ready, ms
+    qint64 m_initialMemoryUsage = 0;
+    qint64 m_accountsMemoryUsage = 0; // KiB taken by the connected accounts
+    qint64 m_initialCpuTime = 0;
+};
+
+#endif // MORSE_LOAD_TEST_HPP
@@ -0,0 +1,119 @@
+#include "syntheticdata.hpp"
+
+#include <TelegramQt/DataStorage>
+
+#include "DataStorage_p.hpp"
+#include "TLTypes.hpp"
+
+#include <QDateTime>
+
+static const quint32 c_firstUserId = 1000000;
+static const quint32 c_firstChatId = 100000;
+
+static quint32 s_lastMessageId = 0;
+
+static TLPeer toTLPeer(const Telegram::Peer &peer)
+{
+    TLPeer result;
+    switch (peer.type) {
+    case Telegram::Peer::User:
+        result.tlType = TLValue::PeerUser;
+        result.userId = peer.id;
+        break;
+    case Telegram::Peer::Chat:
+        result.tlType = TLValue::PeerChat;
+        result.chatId = peer.id;
+        break;
+    case Telegram::Peer::Channel:
+        result.tlType = TLValue::PeerChannel;
+        result.channelId = peer.id;
+        break;
+    }
+    return result;
+}
+
+static TLUser makeUser(quint32 userId)
+{
+    TLUser user;
+    user.tlType = TLValue::User;
+    user.id = userId;
+    user.accessHash = userId * 7ull;
+    user.flags = TLUser::AccessHash|TLUser::FirstName|TLUser::LastName|TLUser::Username|TLUser::Phone;
+    user.firstName = QStringLiteral("First%1").arg(userId);
+    user.lastName = QStringLiteral("Last%1").arg(userId);
+    user.username = QStringLiteral("user%1").arg(userId);
+    user.phone = QStringLiteral("7900%1").arg(userId);
+    return user;
+}
+
+static TLChat makeChat(const Telegram::Peer &peer, int participantsCount)
+{
+    TLChat chat;
+    chat.id = peer.id;
+    chat.title = QStringLiteral("Room %1").arg(peer.id);
+    chat.date = static_cast<quint32>(QDateTime::currentMSecsSinceEpoch() / 1000);
+    if (peer.type == Telegram::Peer::Channel) {
+        chat.tlType = TLValue::Channel;
+        chat.accessHash = peer.id * 11ull;
+        chat.flags = TLChat::AccessHash|TLChat::Megagroup;
+    } else {
+        chat.tlType = TLValue::Chat;
+        chat.participantsCount = participantsCount;
+    }
+    return chat;
+}
+
+SyntheticAccount populateSyntheticData(Telegram::Client::InMemoryDataStorage *storage, int usersCount, int roomsCount)
+{
+    SyntheticAccount account;
+    TLMessagesDialogs dialogs;
+    dialogs.tlType = TLValue::MessagesDialogs;
+
+    account.users.reserve(usersCount);
+    dialogs.users.reserve(usersCount);
+    for (int i = 0; i < usersCount; ++i) {
+        const quint32 userId = c_firstUserId + i;
+        account.users.append(Telegram::Peer::fromUserId(userId));
+        dialogs.users.append(makeUser(userId));
+    }
+
+    account.rooms.reserve(roomsCount);
+    dialogs.chats.reserve(roomsCount);
+    for (int i = 0; i < roomsCount; ++i) {
+        // Half of rooms are legacy groups and half of them are megagroups
+        const quint32 chatId = c_firstChatId + i;
+        const Telegram::Peer peer = (i % 2) ? Telegram::Peer::fromChannelId(chatId) : Telegram::Peer::fromChatId(chatId);
+        account.rooms.append(peer);
+        dialogs.chats.append(makeChat(peer, qMin(usersCount, 200)));
+    }
+
+    const QVector<Telegram::Peer> dialogPeers = account.dialogs();
+    dialogs.dialogs.reserve(dialogPeers.count());
+    for (const Telegram::Peer &peer : dialogPeers) {
+        TLDialog dialog;
+        dialog.tlType = TLValue::Dialog;
+        dialog.peer = toTLPeer(peer);
+        dialogs.dialogs.append(dialog);
+    }
+
+    Telegram::Client::DataInternalApi::get(storage)->processData(dialogs);
+
+    return account;
+}
+
+quint32 addSyntheticMessage(Telegram::Client::InMemoryDataStorage *storage, const Telegram::Peer &peer,
+                            quint32 fromUserId, const QString &text)
+{
+    TLMessage message;
+    message.tlType = TLValue::Message;
+    message.id = ++s_lastMessageId;
+    message.flags = TLMessage::FromId;
+    message.fromId = fromUserId;
+    message.toId = toTLPeer(peer);
+    message.date = static_cast<quint32>(QDateTime::currentMSecsSinceEpoch() / 1000);
+    message.message = text;
+
+    Telegram::Client::DataInternalApi::get(storage)->processData(message);
+
+    return message.id;
+}
@@ -0,0 +1,28 @@
+#ifndef MORSE_SYNTHETIC_DATA_HPP
+#define MORSE_SYNTHETIC_DATA_HPP
+
+#include <TelegramQt/TelegramNamespace>
+
+namespace Telegram {
+
+namespace Client {
+
+class InMemoryDataStorage;
+
+} // Client namespace
+
+} // Telegram namespace
+
+struct SyntheticAccount
+{
+    QVector<Telegram::Peer> users;
+    QVector<Telegram::Peer> rooms;
+
+    QVector<Telegram::Peer> dialogs() const { return users + rooms; }
+};
+
+SyntheticAccount populateSyntheticData(Telegram::Client::InMemoryDataStorage *storage, int usersCount, int roomsCount);
+quint32 addSyntheticMessage(Telegram::Client::InMemoryDataStorage *storage, const Telegram::Peer &peer,
+                            quint32 fromUserId, const QString &text);
+
+#endif // MORSE_SYNTHETIC_DATA_HPP
@@ -0,0 +1,204 @@
+#include "clientbridge.hpp"
+#include "clientthreadpool.hpp"
+
+#include <TelegramQt/Client>
+#include <TelegramQt/ConnectionApi>
+#include <TelegramQt/DataStorage>
+
+#include <QDebug>
+#include <QSemaphore>
+#include <QThread>
+#include <QTimer>
+
+MorseClientBridge::MorseClientBridge(Telegram::Client::Client *client, bool useThread, QObject *parent) :
+    QObject(parent),
+    m_client(client),
+    m_useThread(useThread)
+{
+}
+
+MorseClientBridge::~MorseClientBridge()
+{
+    if (!m_thread) {
+        return;
+    }
+    // Let the already posted calls finish and wait for the client to be deleted:
+    // it uses the app information and other objects owned by the connection
+    Telegram::Client::Client *client = m_client;
+    run([client]() {
+        delete client;
+    });
+    m_client = nullptr;
+    MorseClientThreadPool::instance()->releaseThread(m_thread);
+}
+
+void MorseClientBridge::start()
+{
+    if (!m_useThread || m_thread) {
+        return;
+    }
+
+    // Types of the client signals delivered to the connection via queued connections
+    qRegisterMetaType<Telegram::Peer>("Telegram::Peer");
+    qRegisterMetaType<QVector<quint32>>("QVector<quint32>");
+    qRegisterMetaType<Telegram::Namespace::ContactStatus>("Telegram::Namespace::ContactStatus");
+    qRegisterMetaType<Telegram::MessageAction>("Telegram::MessageAction");
+    qRegisterMetaType<Telegram::Namespace::AuthenticationError>("Telegram::Namespace::AuthenticationError");
+    qRegisterMetaType<Telegram::Client::ConnectionApi::Status>("Telegram::Client::ConnectionApi::Status");
+    qRegisterMetaType<Telegram::Client::ConnectionApi::StatusReason>("Telegram::Client::ConnectionApi::StatusReason");
+
+    m_thread = MorseClientThreadPool::instance()->acquireThread();
+
+    m_client->setParent(nullptr);
+    m_client->moveToThread(m_thread);
+    qDebug() << Q_FUNC_INFO << "Telegram client moved to" << m_thread->objectName();
+}
+
+void MorseClientBridge::post(const std::function<void()> &functor) const
+{
+    if (!isThreaded()) {
+        functor();
+        return;
+    }
+    QTimer::singleShot(0, m_client, functor);
+}
+
+void MorseClientBridge::run(const std::function<void()> &functor) const
+{
+    if (!isThreaded() || (QThread::currentThread() == m_thread)) {
+        functor();
+        return;
+    }
+    QSemaphore done;
+    QTimer::singleShot(0, m_client, [&done, &functor]() {
+        functor();
+        done.release();
+    });
+    done.acquire();
+}
+
+quint32 MorseClientBridge::selfUserId() const
+{
+    return call<quint32>([this]() {
+        return m_client->dataStorage()->selfUserId();
+    });
+}
+
+QVector<Telegram::Peer> MorseClientBridge::dialogs() const
+{
+    return call<QVector<Telegram::Peer>>([this]() {
+        return m_client->dataStorage()->dialogs();
+    });
+}
+
+bool MorseClientBridge::getUserInfo(Telegram::UserInfo *info, quint32 userId) const
+{
+    return call<bool>([this, info, userId]() {
+        return m_client->dataStorage()->getUserInfo(info, userId);
+    });
+}
+
+QVector<Telegram::UserInfo> MorseClientBridge::getUserInfos(QVector<quint32> *userIds) const
+{
+    return call<QVector<Telegram::UserInfo>>([this, userIds]() {
+        QVector<Telegram::UserInfo> users;
+        users.reserve(userIds->count());
+        QVector<quint32> knownIds;
+        knownIds.reserve(userIds->count());
+        for (const quint32 userId : *userIds) {
+            Telegram::UserInfo info;
+            if (m_client->dataStorage()->getUserInfo(&info, userId)) {
+                users.append(info);
+                knownIds.append(userId);
+            }
+        }
+        *userIds = knownIds;
+        return users;
+    });
+}
+
+bool MorseClientBridge::getChatInfo(Telegram::ChatInfo *info, const Telegram::Peer &peer) const
+{
+    return call<bool>([this, info, &peer]() {
+        return m_client->dataStorage()->getChatInfo(info, peer);
+    });
+}
+
+bool MorseClientBridge::getDialogInfo(Telegram::DialogInfo *info, const Telegram::Peer &peer) const
+{
+    return call<bool>([this, info, &peer]() {
+        return m_client->dataStorage()->getDialogInfo(info, peer);
+    });
+}
+
+QVector<quint32> MorseClientBridge::getLastMessageIds(const QVector<Telegram::Peer> &peers) const
+{
+    return call<QVector<quint32>>([this, &peers]() {
+        QVector<quint32> messageIds;
+        messageIds.reserve(peers.count());
+        for (const Telegram::Peer &peer : peers) {
+            Telegram::DialogInfo info;
+            messageIds.append(m_client->dataStorage()->getDialogInfo(&info, peer) ? info.lastMessageId() : 0);
+        }
+        return messageIds;
+    });
+}
+
+QVector<MorseClientBridge::DialogActivity> MorseClientBridge::getDialogActivities(const QVector<Telegram::Peer> &peers) const
+{
+    return call<QVector<DialogActivity>>([this, &peers]() {
+        QVector<DialogActivity> activities;
+        activities.reserve(peers.count());
+        for (const Telegram::Peer &peer : peers) {
+            DialogActivity activity;
+            Telegram::DialogInfo info;
+            if (m_client->dataStorage()->getDialogInfo(&info, peer)) {
+                activity.unreadCount = info.unreadCount();
+                Telegram::Message lastMessage;
+                if (info.lastMessageId() && m_client->dataStorage()->getMessage(&lastMessage, peer, info.lastMessageId())) {
+                    activity.lastMessageTime = lastMessage.timestamp();
+                }
+            }
+            activities.append(activity);
+        }
+        return activities;
+    });
+}
+
+bool MorseClientBridge::getMessage(Telegram::Message *message, const Telegram::Peer &peer, quint32 messageId) const
+{
+    return call<bool>([this, message, &peer, messageId]() {
+        return m_client->dataStorage()->getMessage(message, peer, messageId);
+    });
+}
+
+bool MorseClientBridge::getMessageMediaInfo(Telegram::MessageMediaInfo *info, const Telegram::Peer &peer, quint32 messageId) const
+{
+    return call<bool>([this, info, &peer, messageId]() {
+        return m_client->dataStorage()->getMessageMediaInfo(info, peer, messageId);
+    });
+}
+
+QStringList MorseClientBridge::getPeerNames(const QVector<Telegram::Peer> &peers) const
+{
+    return call<QStringList>([this, &peers]() {
+        QStringList names;
+        names.reserve(peers.count());
+        for (const Telegram::Peer &peer : peers) {
+            QString name;
+            if (peer.type == Telegram::Peer::User) {
+                Telegram::UserInfo info;
+                if (m_client->dataStorage()->getUserInfo(&info, peer.id)) {
+                    name = info.getBestDisplayName();
+                }
+            } else {
+                Telegram::ChatInfo info;
+                if (m_client->dataStorage()->getChatInfo(&info, peer)) {
+                    name = info.title();
+                }
+            }
+            names.append(name);
+        }
+        return names;
+    });
+}
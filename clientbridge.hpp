@@ -0,0 +1,93 @@
+#ifndef MORSE_CLIENT_BRIDGE_HPP
+#define MORSE_CLIENT_BRIDGE_HPP
+
+#include <QObject>
+#include <QStringList>
+
+#include <TelegramQt/TelegramNamespace>
+
+#include <functional>
+
+class QThread;
+
+namespace Telegram {
+
+namespace Client {
+
+class Client;
+
+} // Client namespace
+
+} // Telegram namespace
+
+/**
+ * Serializes MorseConnection access to the Telegram client.
+ *
+ * The client either lives in the connection thread (and then all calls are direct)
+ * or in a worker thread of MorseClientThreadPool. In the latter case the calls are
+ * executed in the worker thread and signals of the client are delivered via queued
+ * connections.
+ *
+ * The client must be fully configured before start(). In the threaded mode the bridge
+ * takes the ownership of the client and its destructor waits for the client to be
+ * deleted in the worker thread.
+ */
+class MorseClientBridge : public QObject
+{
+    Q_OBJECT
+public:
+    MorseClientBridge(Telegram::Client::Client *client, bool useThread, QObject *parent = nullptr);
+    ~MorseClientBridge() override;
+
+    Telegram::Client::Client *client() const { return m_client; }
+    bool isThreaded() const { return m_thread != nullptr; }
+
+    void start();
+
+    // Executes the functor in the client thread and returns immediately
+    void post(const std::function<void()> &functor) const;
+
+    // Executes the functor in the client thread and waits for it to finish
+    void run(const std::function<void()> &functor) const;
+
+    template <typename T>
+    T call(const std::function<T()> &functor) const
+    {
+        if (!isThreaded()) {
+            return functor();
+        }
+        T result;
+        run([&result, &functor]() { result = functor(); });
+        return result;
+    }
+
+    struct DialogActivity
+    {
+        quint32 unreadCount = 0;
+        quint32 lastMessageTime = 0;
+    };
+
+    // Data storage access
+    quint32 selfUserId() const;
+    QVector<Telegram::Peer> dialogs() const;
+    bool getUserInfo(Telegram::UserInfo *info, quint32 userId) const;
+    // Fetches the users in a single call; the unknown users are removed from userIds
+    QVector<Telegram::UserInfo> getUserInfos(QVector<quint32> *userIds) const;
+    bool getChatInfo(Telegram::ChatInfo *info, const Telegram::Peer &peer) const;
+    bool getDialogInfo(Telegram::DialogInfo *info, const Telegram::Peer &peer) const;
+    // The last message ids of the dialogs in a single call; zero for the unknown dialogs
+    QVector<quint32> getLastMessageIds(const QVector<Telegram::Peer> &peers) const;
+    // The unread counts and the last message timestamps of the dialogs in a single call; zeros for the unknown
+    QVector<DialogActivity> getDialogActivities(const QVector<Telegram::Peer> &peers) const;
+    bool getMessage(Telegram::Message *message, const Telegram::Peer &peer, quint32 messageId) const;
+    bool getMessageMediaInfo(Telegram::MessageMediaInfo *info, const Telegram::Peer &peer, quint32 messageId) const;
+    // The user display names or the chat titles in a single call; empty for the unknown peers
+    QStringList getPeerNames(const QVector<Telegram::Peer> &peers) const;
+
+protected:
+    Telegram::Client::Client *m_client = nullptr;
+    QThread *m_thread = nullptr;
+    bool m_useThread = false;
+};
+
+#endif // MORSE_CLIENT_BRIDGE_HPP
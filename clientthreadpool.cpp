@@ -0,0 +1,83 @@
+#include "clientthreadpool.hpp"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QThread>
+
+static MorseClientThreadPool *s_instance = nullptr;
+
+MorseClientThreadPool::MorseClientThreadPool(QObject *parent) :
+    QObject(parent),
+    m_maxThreadCount(qMax(1, QThread::idealThreadCount()))
+{
+}
+
+MorseClientThreadPool::~MorseClientThreadPool()
+{
+    for (const Worker &worker : m_workers) {
+        worker.thread->quit();
+    }
+    for (const Worker &worker : m_workers) {
+        worker.thread->wait();
+    }
+    if (s_instance == this) {
+        s_instance = nullptr;
+    }
+}
+
+MorseClientThreadPool *MorseClientThreadPool::instance()
+{
+    if (!s_instance) {
+        s_instance = new MorseClientThreadPool(QCoreApplication::instance());
+    }
+    return s_instance;
+}
+
+void MorseClientThreadPool::setMaxThreadCount(int count)
+{
+    // Already started threads are kept; the limit applies to the new ones
+    m_maxThreadCount = qMax(1, count);
+}
+
+int MorseClientThreadPool::clientsCount() const
+{
+    int result = 0;
+    for (const Worker &worker : m_workers) {
+        result += worker.clientsCount;
+    }
+    return result;
+}
+
+QThread *MorseClientThreadPool::acquireThread()
+{
+    int leastLoaded = -1;
+    for (int i = 0; i < m_workers.count(); ++i) {
+        if ((leastLoaded < 0) || (m_workers.at(i).clientsCount < m_workers.at(leastLoaded).clientsCount)) {
+            leastLoaded = i;
+        }
+    }
+
+    if ((leastLoaded < 0) || (m_workers.at(leastLoaded).clientsCount && (m_workers.count() < m_maxThreadCount))) {
+        Worker worker;
+        worker.thread = new QThread(this);
+        worker.thread->setObjectName(QStringLiteral("TelegramClient-%1").arg(m_workers.count() + 1));
+        worker.thread->start();
+        m_workers.append(worker);
+        leastLoaded = m_workers.count() - 1;
+        qDebug() << Q_FUNC_INFO << "Started client thread" << worker.thread->objectName();
+    }
+
+    ++m_workers[leastLoaded].clientsCount;
+    return m_workers.at(leastLoaded).thread;
+}
+
+void MorseClientThreadPool::releaseThread(QThread *thread)
+{
+    for (Worker &worker : m_workers) {
+        if (worker.thread == thread) {
+            --worker.clientsCount;
+            return;
+        }
+    }
+    qWarning() << Q_FUNC_INFO << "Unknown thread" << thread;
+}
@@ -0,0 +1,45 @@
+#ifndef MORSE_CLIENT_THREAD_POOL_HPP
+#define MORSE_CLIENT_THREAD_POOL_HPP
+
+#include <QObject>
+#include <QVector>
+
+class QThread;
+
+/**
+ * A pool of threads shared by the Telegram clients of all connections.
+ *
+ * Each client is assigned to the least loaded thread; a new thread is started
+ * only if every existing one already serves a client and the limit is not reached.
+ * The pool is supposed to be used from the main thread only.
+ */
+class MorseClientThreadPool : public QObject
+{
+    Q_OBJECT
+public:
+    static MorseClientThreadPool *instance();
+
+    int maxThreadCount() const { return m_maxThreadCount; }
+    void setMaxThreadCount(int count);
+
+    int threadCount() const { return m_workers.count(); }
+    int clientsCount() const;
+
+    QThread *acquireThread();
+    void releaseThread(QThread *thread);
+
+protected:
+    explicit MorseClientThreadPool(QObject *parent = nullptr);
+    ~MorseClientThreadPool() override;
+
+    struct Worker
+    {
+        QThread *thread = nullptr;
+        int clientsCount = 0;
+    };
+
+    QVector<Worker> m_workers;
+    int m_maxThreadCount = 1;
+};
+
+#endif // MORSE_CLIENT_THREAD_POOL_HPP
@@ -19,11 +19,22 @@
 
 #include "connection.hpp"
 
+#include "clientbridge.hpp"
+#include "contactinfo.hpp"
 #include "datastorage.hpp"
+#include "eventloopmonitor.hpp"
 #include "info.hpp"
+#include "keepalive.hpp"
+#include "metrics.hpp"
+#include "outgoingqueue.hpp"
 #include "protocol.hpp"
+#include "syncscheduler.hpp"
 #include "textchannel.hpp"
 
+#ifdef ENABLE_FILE_TRANSFER
+#include "filetransferchannel.hpp"
+#endif
+
 #if TP_QT_VERSION < TP_QT_VERSION_CHECK(0, 9, 8)
 #include "contactgroups.hpp"
 #endif
@@ -47,14 +58,29 @@
 #include <TelepathyQt/Constants>
 #include <TelepathyQt/BaseChannel>
 
+#include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QTimer>
 
 #include <QStandardPaths>
 
+#include <algorithm>
+
 #define DIALOGS_AS_CONTACTLIST
-//#define BROADCAST_AS_CONTACT
 
 static constexpr int c_selfHandle = 1;
+static constexpr uint c_defaultSyncLimit = 30;
+static constexpr uint c_defaultSyncWaveSize = 10;
+static constexpr int c_roomListChunkSize = 100; // Dialogs processed per event loop iteration
+static constexpr int c_aliasUpdateDelay = 500; // ms, coalesces AliasesChanged of a burst of updates
+static constexpr int c_rosterSaveDelay = 5000; // ms, coalesces the saves of a burst of roster changes
+static constexpr int c_handleSweepInterval = 10 * 60 * 1000; // ms
+static constexpr quint32 c_handleIdleSweeps = 6; // A handle unused for that many sweeps is reclaimed
+static const QByteArray c_contactHandlesGauge = QByteArrayLiteral("handles.contacts");
+static const QByteArray c_roomHandlesGauge = QByteArrayLiteral("handles.rooms");
+static const QByteArray c_resumeDuration = QByteArrayLiteral("connection.resume"); // From the connection loss to ready
 static const QString c_onlineSimpleStatusKey = QLatin1String("available");
 static const QString c_saslMechanismTelepathyPassword = QLatin1String("X-TELEPATHY-PASSWORD");
 
@@ -89,7 +115,7 @@ static Tp::SimplePresence telegramStatusToTelepathyPresence(Telegram::Namespace:
     return presence;
 }
 
-Tp::SimpleStatusSpecMap MorseConnection::getSimpleStatusSpecMap()
+static Tp::SimpleStatusSpecMap createSimpleStatusSpecMap()
 {
     //Presence
     Tp::SimpleStatusSpec spOffline;
@@ -120,7 +146,7 @@ Tp::SimpleStatusSpecMap MorseConnection::getSimpleStatusSpecMap()
     return specs;
 }
 
-Tp::RequestableChannelClassSpecList MorseConnection::getRequestableChannelList()
+static Tp::RequestableChannelClassSpecList createRequestableChannelList()
 {
     Tp::RequestableChannelClassSpecList result;
 
@@ -132,6 +158,20 @@ Tp::RequestableChannelClassSpecList MorseConnection::getRequestableChannelList()
     personalChat.allowedProperties.append(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetID"));
     result << Tp::RequestableChannelClassSpec(personalChat);
 
+#ifdef ENABLE_FILE_TRANSFER
+    Tp::RequestableChannelClass personalFileTransfer;
+    personalFileTransfer.fixedProperties[TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType")] = TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER;
+    personalFileTransfer.fixedProperties[TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType")]  = Tp::HandleTypeContact;
+    personalFileTransfer.allowedProperties.append(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle"));
+    personalFileTransfer.allowedProperties.append(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetID"));
+    personalFileTransfer.allowedProperties.append(TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".ContentType"));
+    personalFileTransfer.allowedProperties.append(TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".Filename"));
+    personalFileTransfer.allowedProperties.append(TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".Size"));
+    personalFileTransfer.allowedProperties.append(TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".Description"));
+    personalFileTransfer.allowedProperties.append(TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".Date"));
+    result << Tp::RequestableChannelClassSpec(personalFileTransfer);
+#endif // ENABLE_FILE_TRANSFER
+
 #ifdef ENABLE_GROUP_CHAT
     Tp::RequestableChannelClass groupChat;
     groupChat.fixedProperties[TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType")] = TP_QT_IFACE_CHANNEL_TYPE_TEXT;
@@ -148,6 +188,25 @@ Tp::RequestableChannelClassSpecList MorseConnection::getRequestableChannelList()
     return result;
 }
 
+// The specs are the same for all connections, so they are built once and implicitly shared
+Tp::SimpleStatusSpecMap MorseConnection::getSimpleStatusSpecMap()
+{
+    static const Tp::SimpleStatusSpecMap specs = createSimpleStatusSpecMap();
+    return specs;
+}
+
+Tp::RequestableChannelClassSpecList MorseConnection::getRequestableChannelList()
+{
+    static const Tp::RequestableChannelClassSpecList specs = createRequestableChannelList();
+    return specs;
+}
+
+static Tp::RequestableChannelClassList requestableChannelClasses()
+{
+    static const Tp::RequestableChannelClassList classes = MorseConnection::getRequestableChannelList().bareClasses();
+    return classes;
+}
+
 MorseConnection::MorseConnection(const QDBusConnection &dbusConnection, const QString &cmName, const QString &protocolName, const QVariantMap &parameters) :
     Tp::BaseConnection(dbusConnection, cmName, protocolName, parameters)
 {
@@ -158,6 +217,8 @@ MorseConnection::MorseConnection(const QDBusConnection &dbusConnection, const QS
     m_serverKeyFile = MorseProtocol::getServerKey(parameters);
     m_keepAliveInterval = MorseProtocol::getKeepAliveInterval(parameters, Client::Settings::defaultPingInterval() / 1000);
     m_enableAuthentication = MorseProtocol::getEnableAuthentication(parameters);
+    m_inlineThumbnails = MorseProtocol::getInlineThumbnails(parameters);
+    m_broadcastAsContact = MorseProtocol::getBroadcastAsContact(parameters);
 
     /* Connection.Interface.Contacts */
     contactsIface = Tp::BaseConnectionContactsInterface::create();
@@ -229,7 +290,7 @@ MorseConnection::MorseConnection(const QDBusConnection &dbusConnection, const QS
 
     /* Connection.Interface.Requests */
     requestsIface = Tp::BaseConnectionRequestsInterface::create(this);
-    requestsIface->requestableChannelClasses = getRequestableChannelList().bareClasses();
+    requestsIface->requestableChannelClasses = requestableChannelClasses();
 
     plugInterface(Tp::AbstractConnectionInterfacePtr::dynamicCast(requestsIface));
 
@@ -241,8 +302,15 @@ MorseConnection::MorseConnection(const QDBusConnection &dbusConnection, const QS
     connect(this, &BaseConnection::disconnected, this, &MorseConnection::onDisconnected);
 
     m_contactHandles.insert(c_selfHandle, Telegram::Peer());
+    m_lastContactHandle = c_selfHandle;
+    MorseMetrics::instance()->addToGauge(c_contactHandlesGauge, 1);
     setSelfHandle(c_selfHandle);
 
+    m_handleSweepTimer = new QTimer(this);
+    m_handleSweepTimer->setInterval(c_handleSweepInterval);
+    connect(m_handleSweepTimer, &QTimer::timeout, this, &MorseConnection::reclaimHandles);
+    m_handleSweepTimer->start();
+
     m_appInfo = new Client::AppInformation(this);
     m_appInfo->setAppId(MorseInfo::appId());
     m_appInfo->setAppHash(MorseInfo::appHash());
@@ -252,6 +320,7 @@ MorseConnection::MorseConnection(const QDBusConnection &dbusConnection, const QS
     m_appInfo->setLanguageCode(QLocale::system().bcp47Name());
 
     m_client = new Client::Client(this);
+    m_bridge = new MorseClientBridge(m_client, MorseProtocol::getEnableClientThread(parameters), this);
 
     m_info = new MorseInfo(this);
     m_info->setAccountIdentifier(m_selfPhone);
@@ -288,15 +357,25 @@ MorseConnection::MorseConnection(const QDBusConnection &dbusConnection, const QS
     m_dataStorage->setInfo(m_info);
     m_client->setDataStorage(m_dataStorage);
 
-    clientSettings->setPingInterval(m_keepAliveInterval * 1000);
+    m_keepAlive = new MorseKeepAlive(m_bridge, this);
+    m_keepAlive->setEnabled(MorseProtocol::getKeepAlive(parameters));
+    m_keepAlive->setInterval(m_keepAliveInterval * 1000);
+    // Zero disables the pings
+    clientSettings->setPingInterval(m_keepAlive->interval());
     m_client->setAppInformation(m_appInfo);
     m_client->messagingApi()->setSyncMode(Client::MessagingApi::ManualSync);
-    m_client->messagingApi()->setSyncLimit(30);
+    m_client->messagingApi()->setSyncLimit(c_defaultSyncLimit);
 
     connect(m_client->connectionApi(), &Telegram::Client::ConnectionApi::statusChanged,
             this, &MorseConnection::onConnectionStatusChanged);
+    m_outgoingQueue = new MorseOutgoingQueue(m_bridge, this);
+    m_outgoingQueue->setInfo(m_info);
     connect(m_client->messagingApi(), &Telegram::Client::MessagingApi::messageSent,
-             this, &MorseConnection::onMessageSent);
+            m_outgoingQueue, &MorseOutgoingQueue::onMessageSent);
+    connect(m_outgoingQueue, &MorseOutgoingQueue::messageSent,
+            this, &MorseConnection::onMessageSent);
+    connect(m_outgoingQueue, &MorseOutgoingQueue::messageFailed,
+            this, &MorseConnection::onMessageFailed);
     connect(m_client->messagingApi(), &Telegram::Client::MessagingApi::messageReceived,
              this, &MorseConnection::onNewMessageReceived);
     connect(m_client->messagingApi(), &Telegram::Client::MessagingApi::syncMessages,
@@ -305,6 +384,14 @@ MorseConnection::MorseConnection(const QDBusConnection &dbusConnection, const QS
 //            this, &MorseConnection::whenChatChanged);
     connect(m_client->contactsApi(), &Telegram::Client::ContactsApi::contactStatusChanged,
             this, &MorseConnection::onContactStatusChanged);
+    connect(m_client->messagingApi(), &Telegram::Client::MessagingApi::messageActionChanged,
+            this, &MorseConnection::onMessageActionChanged);
+    connect(m_client->messagingApi(), &Telegram::Client::MessagingApi::messageReadInbox,
+            this, &MorseConnection::onMessageReadInbox);
+    connect(m_client->messagingApi(), &Telegram::Client::MessagingApi::messageReadOutbox,
+            this, &MorseConnection::onMessageReadOutbox);
+    connect(this, &MorseConnection::chatDetailsChanged,
+            this, &MorseConnection::onChatDetailsChanged);
 
     const QString proxyType = MorseProtocol::getProxyType(parameters);
     if (!proxyType.isEmpty()) {
@@ -330,9 +417,36 @@ MorseConnection::MorseConnection(const QDBusConnection &dbusConnection, const QS
         }
     }
 
+    m_bridge->start();
+
+    m_syncScheduler = new MorseSyncScheduler(m_bridge, this);
+    m_contactInfoCache = new MorseContactInfoCache(m_bridge, this);
+    m_syncScheduler->setSyncLimit(MorseProtocol::getSyncLimit(parameters, c_defaultSyncLimit));
+    m_syncScheduler->setWaveSize(MorseProtocol::getSyncWaveSize(parameters, c_defaultSyncWaveSize));
+
     loadState();
 }
 
+MorseConnection::~MorseConnection()
+{
+    MorseMetrics::instance()->addToGauge(c_contactHandlesGauge, -m_contactHandles.count());
+    MorseMetrics::instance()->addToGauge(c_roomHandlesGauge, -m_chatHandles.count());
+
+    // Wait for the client calls in flight and for the client deletion while the connection
+    // (and the app information and the info used by the client) is still intact
+    delete m_bridge;
+    m_bridge = nullptr;
+
+    // The queue saves the pending changes on destruction, so delete it before the info
+    delete m_outgoingQueue;
+    m_outgoingQueue = nullptr;
+
+    // The client is deleted, so nothing reads the spool files of the unfinished uploads anymore
+    for (const FileUpload &upload : m_fileUploads) {
+        QFile::remove(upload.filePath);
+    }
+}
+
 void MorseConnection::doConnect(Tp::DBusError *error)
 {
     Q_UNUSED(error);
@@ -340,9 +454,17 @@ void MorseConnection::doConnect(Tp::DBusError *error)
     m_authReconnectionsCount = 0;
     setStatus(Tp::ConnectionStatusConnecting, Tp::ConnectionStatusReasonRequested);
 
-    if (m_client->accountStorage()->loadData() && m_client->accountStorage()->hasMinimalDataSet()) {
-        Telegram::Client::AuthOperation *checkInOperation = m_client->connectionApi()->checkIn();
-        checkInOperation->connectToFinished(this, &MorseConnection::onCheckInFinished, checkInOperation);
+    const bool hasAccountData = m_bridge->call<bool>([this]() {
+        return m_client->accountStorage()->loadData() && m_client->accountStorage()->hasMinimalDataSet();
+    });
+    if (hasAccountData) {
+        // The roster is published now, but the status stays Connecting until the check in succeeds:
+        // if it fails, the authentication channel is only handled on a connecting connection.
+        publishRosterSnapshot();
+        m_bridge->post([this]() {
+            Telegram::Client::AuthOperation *checkInOperation = m_client->connectionApi()->checkIn();
+            checkInOperation->connectToFinished(this, &MorseConnection::onCheckInFinished, checkInOperation);
+        });
     } else {
         tryToStartAuthentication();
     }
@@ -359,25 +481,40 @@ void MorseConnection::tryToStartAuthentication()
 
 void MorseConnection::signInOrUp()
 {
-    m_signOperation = m_client->connectionApi()->startAuthentication();
-    m_signOperation->setPhoneNumber(m_client->accountStorage()->phoneNumber());
-
-    connect(m_signOperation, &Client::AuthOperation::authCodeRequired,
-            this, &MorseConnection::onAuthCodeRequired);
-    connect(m_signOperation, &Client::AuthOperation::errorOccurred,
-            this, &MorseConnection::onAuthErrorOccurred);
-    connect(m_signOperation, &Client::AuthOperation::passwordRequired,
-            this, &MorseConnection::onPasswordRequired);
-    connect(m_signOperation, &Client::AuthOperation::passwordCheckFailed,
-            this, &MorseConnection::onPasswordCheckFailed);
-    connect(m_signOperation, &PendingOperation::finished,
-            this, &MorseConnection::onSignInFinished);
+    // The operation is connected in the client thread to not miss any of its signals
+    m_signOperation = m_bridge->call<Client::AuthOperation *>([this]() {
+        Client::AuthOperation *signOperation = m_client->connectionApi()->startAuthentication();
+        signOperation->setPhoneNumber(m_client->accountStorage()->phoneNumber());
+
+        connect(signOperation, &Client::AuthOperation::authCodeRequired,
+                this, &MorseConnection::onAuthCodeRequired);
+        connect(signOperation, &Client::AuthOperation::errorOccurred,
+                this, &MorseConnection::onAuthErrorOccurred);
+        connect(signOperation, &Client::AuthOperation::passwordRequired,
+                this, &MorseConnection::onPasswordRequired);
+        connect(signOperation, &Client::AuthOperation::passwordCheckFailed,
+                this, &MorseConnection::onPasswordCheckFailed);
+        connect(signOperation, &PendingOperation::finished,
+                this, &MorseConnection::onSignInFinished);
+        return signOperation;
+    });
 }
 
 void MorseConnection::onConnectionStatusChanged(Client::ConnectionApi::Status status,
                                                 Client::ConnectionApi::StatusReason reason)
 {
     qDebug() << Q_FUNC_INFO << status << reason;
+    // Buffer the outgoing messages while reconnecting
+    m_outgoingQueue->setOnline(status == Client::ConnectionApi::StatusReady);
+    if (status == Client::ConnectionApi::StatusReady) {
+        m_keepAlive->onConnectionReady();
+    } else {
+        m_keepAlive->onConnectionLost(reason == Client::ConnectionApi::StatusReasonLocal);
+    }
+    if ((status != Client::ConnectionApi::StatusReady) && m_dialogsSynced && !m_resumeTimer.isValid()) {
+        m_resumeTimer.start();
+    }
+
     switch (status) {
     case Client::ConnectionApi::StatusConnected:
         onAuthenticated();
@@ -385,6 +522,10 @@ void MorseConnection::onConnectionStatusChanged(Client::ConnectionApi::Status st
     case Client::ConnectionApi::StatusReady:
         onConnectionReady();
         updateSelfContactState(Tp::ConnectionStatusConnected);
+        if (m_resumeTimer.isValid()) {
+            MorseMetrics::instance()->recordDuration(c_resumeDuration, m_resumeTimer.elapsed());
+            m_resumeTimer.invalidate();
+        }
         break;
     case Client::ConnectionApi::StatusDisconnected:
         if (reason == Client::ConnectionApi::StatusReasonLocal) {
@@ -414,23 +555,117 @@ void MorseConnection::onAuthenticated()
         saslIface_password->setSaslStatus(Tp::SASLStatusSucceeded, QLatin1String("Succeeded"), QVariantMap());
     }
 
-    contactListIface->setContactListState(Tp::ContactListStateWaiting);
+    // Keep the already published (e.g. the last known) roster until the live one arrives
+    if (!m_contactListPublished) {
+        contactListIface->setContactListState(Tp::ContactListStateWaiting);
+        return;
+    }
+
+    // The clients read the contact list of a connected connection only, so do not wait
+    // for the client to get ready (the initial sync) to let them use the last known roster
+    if (status() != Tp::ConnectionStatusConnected) {
+        setStatus(Tp::ConnectionStatusConnected, Tp::ConnectionStatusReasonRequested);
+    }
 }
 
 void MorseConnection::onSelfUserAvailable()
 {
     qDebug() << Q_FUNC_INFO;
 
-    const Telegram::Peer selfIdentifier = Telegram::Peer::fromUserId(m_client->contactsApi()->selfUserId());
+    const quint32 selfUserId = m_bridge->call<quint32>([this]() {
+        return m_client->contactsApi()->selfUserId();
+    });
+    const Telegram::Peer selfIdentifier = Telegram::Peer::fromUserId(selfUserId);
     if (!selfIdentifier.isValid()) {
         qCritical() << Q_FUNC_INFO << "Self id unexpectedly not available";
         return;
     }
 
+    setSelfPeer(selfIdentifier);
+}
+
+void MorseConnection::setSelfPeer(const Telegram::Peer &selfIdentifier)
+{
+    m_contactHandleIds.remove(m_contactHandles.value(c_selfHandle));
     m_contactHandles.insert(c_selfHandle, selfIdentifier);
+    m_contactHandleIds.insert(selfIdentifier, c_selfHandle);
     setSelfContact(c_selfHandle, selfIdentifier.toString());
 }
 
+/**
+ * Publishes the roster saved on the last disconnect
+ *
+ * The presences are unknown until the live contact list arrives and
+ * setContactList() reconciles the roster with it.
+ *
+ * \return true if there was a roster to publish
+ */
+bool MorseConnection::publishRosterSnapshot()
+{
+    MORSE_MONITOR_SCOPE();
+    // Loaded by loadState() in the constructor, nothing else touches it until the client is connected
+    const Telegram::Peer selfIdentifier = Telegram::Peer::fromUserId(m_dataStorage->rosterSelfUserId());
+    const QVector<MorseDataStorage::RosterEntry> roster = m_dataStorage->roster();
+    if (!selfIdentifier.isValid() || roster.isEmpty()) {
+        return false;
+    }
+    qDebug() << Q_FUNC_INFO << roster.count() << "contacts";
+
+    setSelfPeer(selfIdentifier);
+
+    Tp::ContactSubscriptionMap changes;
+    Tp::HandleIdentifierMap identifiersMap;
+    Tp::SimpleContactPresences presences;
+    Tp::ContactSubscriptions change;
+    change.publish = Tp::SubscriptionStateYes;
+    change.subscribe = Tp::SubscriptionStateYes;
+    const Tp::SimplePresence unknownPresence = telegramStatusToTelepathyPresence(Namespace::ContactStatusUnknown);
+
+    m_contactList.clear();
+    m_contactList.reserve(roster.count());
+    for (const MorseDataStorage::RosterEntry &entry : roster) {
+        const uint handle = ensureContact(entry.peer);
+        if (!entry.alias.isEmpty()) {
+            m_aliases.insert(entry.peer, entry.alias);
+        }
+        if (!entry.avatarToken.isEmpty()) {
+            m_snapshotAvatarTokens.insert(entry.peer, entry.avatarToken);
+        }
+        m_contactList.append(handle);
+        changes[handle] = change;
+        identifiersMap[handle] = entry.peer.toString();
+        presences[handle] = unknownPresence;
+    }
+
+    contactListIface->contactsChangedWithID(changes, identifiersMap, Tp::HandleIdentifierMap());
+    simplePresenceIface->setPresences(presences);
+    contactListIface->setContactListState(Tp::ContactListStateSuccess);
+    m_contactListPublished = true;
+    return true;
+}
+
+QVector<MorseDataStorage::RosterEntry> MorseConnection::getRosterSnapshot()
+{
+    QVector<Telegram::Peer> peers;
+    peers.reserve(m_contactList.count());
+    for (const uint handle : m_contactList) {
+        peers.append(m_contactHandles.value(handle));
+    }
+    fetchAliases(peers);
+    const QHash<Telegram::Peer, QString> avatarTokens = getAvatarTokens(peers);
+
+    QVector<MorseDataStorage::RosterEntry> roster;
+    roster.reserve(peers.count());
+    for (const Telegram::Peer &peer : peers) {
+        MorseDataStorage::RosterEntry entry;
+        entry.peer = peer;
+        entry.alias = m_aliases.value(peer);
+        entry.avatarToken = avatarTokens.value(peer);
+        roster.append(entry);
+    }
+    return roster;
+}
+
 void MorseConnection::onAuthCodeRequired()
 {
     qDebug() << Q_FUNC_INFO;
@@ -545,7 +780,9 @@ void MorseConnection::onAccountInvalidated(const QString &accountIdentifier)
 {
     qWarning() << Q_FUNC_INFO << accountIdentifier;
     if (accountIdentifier == m_info->accountIdentifier()) {
-        m_client->accountStorage()->sync();
+        m_bridge->post([this]() {
+            m_client->accountStorage()->sync();
+        });
     }
 }
 
@@ -558,7 +795,10 @@ void MorseConnection::startMechanismWithData_authCode(const QString &mechanism,
     }
 
     saslIface_authCode->setSaslStatus(Tp::SASLStatusInProgress, QLatin1String("InProgress"), QVariantMap());
-    m_signOperation->submitAuthCode(QString::fromLatin1(data));
+    const QString authCode = QString::fromLatin1(data);
+    m_bridge->post([this, authCode]() {
+        m_signOperation->submitAuthCode(authCode);
+    });
 }
 
 void MorseConnection::startMechanismWithData_password(const QString &mechanism, const QByteArray &data, Tp::DBusError *error)
@@ -570,12 +810,18 @@ void MorseConnection::startMechanismWithData_password(const QString &mechanism,
     }
 
     saslIface_password->setSaslStatus(Tp::SASLStatusInProgress, QLatin1String("InProgress"), QVariantMap());
-    m_signOperation->submitPassword(QString::fromUtf8(data));
+    const QString password = QString::fromUtf8(data);
+    m_bridge->post([this, password]() {
+        m_signOperation->submitPassword(password);
+    });
 }
 
 void MorseConnection::onConnectionReady()
 {
     qDebug() << Q_FUNC_INFO;
+    invalidateRoomSummary(Telegram::Peer());
+    invalidateUserInfo(0);
+    m_broadcastChannels.clear();
     //m_core->setOnlineStatus(m_wantedPresence == c_onlineSimpleStatusKey);
     //m_core->setMessageReceivingFilter(TelegramNamespace::MessageFlagNone);
 
@@ -583,25 +829,35 @@ void MorseConnection::onConnectionReady()
     if (m_dialogs) {
         onDialogsReady();
     } else {
-        m_dialogs = m_client->messagingApi()->getDialogList();
-        connect(m_dialogs->becomeReady(), &PendingOperation::finished, this, &MorseConnection::onDialogsReady);
+        m_dialogs = m_bridge->call<Client::DialogList *>([this]() {
+            Client::DialogList *dialogs = m_client->messagingApi()->getDialogList();
+            connect(dialogs->becomeReady(), &PendingOperation::finished, this, &MorseConnection::onDialogsReady);
+            return dialogs;
+        });
     }
 #else
     if (m_contacts) {
         onContactListChanged();
     } else {
-        m_contacts = m_client->contactsApi()->getContactList();
-        connect(m_contacts->becomeReady(), &PendingOperation::finished, this, &MorseConnection::onContactListChanged);
+        m_contacts = m_bridge->call<Client::ContactList *>([this]() {
+            Client::ContactList *contacts = m_client->contactsApi()->getContactList();
+            connect(contacts->becomeReady(), &PendingOperation::finished, this, &MorseConnection::onContactListChanged);
+            return contacts;
+        });
     }
 #endif
 
     onSelfUserAvailable();
 
-    setStatus(Tp::ConnectionStatusConnected, Tp::ConnectionStatusReasonRequested);
+    // Already connected on a reconnect or with the last known roster
+    if (status() != Tp::ConnectionStatusConnected) {
+        setStatus(Tp::ConnectionStatusConnected, Tp::ConnectionStatusReasonRequested);
+    }
 }
 
 QStringList MorseConnection::inspectHandles(uint handleType, const Tp::UIntList &handles, Tp::DBusError *error)
 {
+    MORSE_MONITOR_SCOPE();
     qDebug() << Q_FUNC_INFO << handleType << handles;
 
     switch (handleType) {
@@ -617,6 +873,7 @@ QStringList MorseConnection::inspectHandles(uint handleType, const Tp::UIntList
 
     QStringList result;
 
+    touchHandles(handleType, handles);
     const QMap<uint, Telegram::Peer> handlesContainer = handleType == Tp::HandleTypeContact ? m_contactHandles : m_chatHandles;
 
     foreach (uint handle, handles) {
@@ -711,12 +968,23 @@ Tp::BaseChannelPtr MorseConnection::createChannelCB(const QVariantMap &request,
         MorseTextChannelPtr textChannel = MorseTextChannel::create(this, baseChannel.data());
         baseChannel->plugInterface(Tp::AbstractChannelInterfacePtr::dynamicCast(textChannel));
 
-        if (targetHandleType == Tp::HandleTypeRoom) {
-            connect(this, &MorseConnection::chatDetailsChanged,
-                    textChannel.data(), &MorseTextChannel::onChatDetailsChanged);
+        m_textChannels.insert(targetID, textChannel.data());
+        connect(baseChannel.data(), &Tp::BaseChannel::closed, this, [this, targetID]() {
+            m_textChannels.remove(targetID);
+            m_syncScheduler->resetLazySync(targetID);
+        });
 
+        if (targetHandleType == Tp::HandleTypeRoom) {
             // onChatChanged(targetID.id);
+
+            // Group chats are not synced on connect, fetch the backlog of the opened one
+            m_syncScheduler->requestLazySync(targetID);
         }
+#ifdef ENABLE_FILE_TRANSFER
+    } else if (channelType == TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER) {
+        MorseFileTransferChannelPtr fileTransferChannel = MorseFileTransferChannel::create(this, baseChannel.data(), request);
+        baseChannel->plugInterface(Tp::AbstractChannelInterfacePtr::dynamicCast(fileTransferChannel));
+#endif
     }
 
     return baseChannel;
@@ -724,6 +992,11 @@ Tp::BaseChannelPtr MorseConnection::createChannelCB(const QVariantMap &request,
 
 MorseTextChannelPtr MorseConnection::ensureTextChannel(const Peer &peer)
 {
+    // The common case is a message for an already opened channel
+    if (MorseTextChannel *channel = textChannel(peer)) {
+        return MorseTextChannelPtr(channel);
+    }
+
     bool groupChatMessage = peerIsRoom(peer);
 
     if (groupChatMessage) {
@@ -758,6 +1031,7 @@ MorseTextChannelPtr MorseConnection::ensureTextChannel(const Peer &peer)
 
 Tp::UIntList MorseConnection::requestHandles(uint handleType, const QStringList &identifiers, Tp::DBusError *error)
 {
+    MORSE_MONITOR_SCOPE();
     qDebug() << Q_FUNC_INFO << identifiers;
 
     if (handleType != Tp::HandleTypeContact) {
@@ -787,6 +1061,40 @@ Tp::ContactAttributesMap MorseConnection::getContactAttributes(const Tp::UIntLis
 {
 //    http://telepathy.freedesktop.org/spec/Connection_Interface_Contacts.html#Method:GetContactAttributes
 //    qDebug() << Q_FUNC_INFO << handles << interfaces;
+    MORSE_MONITOR_SCOPE();
+
+    touchHandles(Tp::HandleTypeContact, handles);
+
+    const bool wantAliases = interfaces.contains(TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING);
+    const bool wantAvatars = interfaces.contains(TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS);
+    const bool wantContactInfo = interfaces.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO);
+
+    // Fetch the data of all contacts at once: each client call can be a round trip to the client thread
+    QVector<Telegram::Peer> peers;
+    QVector<quint32> userIds;
+    peers.reserve(handles.count());
+    userIds.reserve(handles.count());
+    for (const uint handle : handles) {
+        const Telegram::Peer identifier = m_contactHandles.value(handle);
+        if (!identifier.isValid()) {
+            continue;
+        }
+        peers.append(identifier);
+        if (identifier.type == Telegram::Peer::User) {
+            userIds.append(identifier.id);
+        }
+    }
+    if (wantAliases) {
+        fetchAliases(peers);
+    }
+    QHash<quint32, Tp::ContactInfoFieldList> contactInfo;
+    if (wantContactInfo) {
+        contactInfo = m_contactInfoCache->contactInfo(userIds);
+    }
+    QHash<Telegram::Peer, QString> avatarTokens;
+    if (wantAvatars) {
+        avatarTokens = getAvatarTokens(peers);
+    }
 
     Tp::ContactAttributesMap contactAttributes;
 
@@ -800,11 +1108,6 @@ Tp::ContactAttributesMap MorseConnection::getContactAttributes(const Tp::UIntLis
             }
             attributes[TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")] = identifier.toString();
 
-            Telegram::UserInfo info;
-            if (!m_client->dataStorage()->getUserInfo(&info, identifier.id)) {
-                qWarning() << Q_FUNC_INFO << "Unknown userId" << identifier.id;
-            }
-
             if (interfaces.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST)) {
                 attributes[TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/subscribe")] = Tp::SubscriptionStateYes;
                 attributes[TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/publish")] = Tp::SubscriptionStateYes;
@@ -814,19 +1117,19 @@ Tp::ContactAttributesMap MorseConnection::getContactAttributes(const Tp::UIntLis
                 attributes[TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE + QLatin1String("/presence")] = QVariant::fromValue(getPresence(handle));
             }
 
-            if (interfaces.contains(TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING)) {
-                attributes[TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias")] = QVariant::fromValue(info.getBestDisplayName());
+            if (wantAliases) {
+                attributes[TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias")] = QVariant::fromValue(m_aliases.value(identifier));
             }
 
-            if (interfaces.contains(TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS)) {
-                Telegram::FileInfo pictureInfo;
-                if (info.getPeerPicture(&pictureInfo, Telegram::PeerPictureSize::Small)) {
-                    attributes[TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token")] = QVariant::fromValue(pictureInfo.getFileId());
+            if (wantAvatars) {
+                const QString avatarToken = avatarTokens.value(identifier);
+                if (!avatarToken.isEmpty()) {
+                    attributes[TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token")] = QVariant::fromValue(avatarToken);
                 }
             }
 
-            if (interfaces.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO)) {
-                attributes[TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO + QLatin1String("/info")] = QVariant::fromValue(getUserInfo(identifier.id));
+            if (wantContactInfo) {
+                attributes[TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO + QLatin1String("/info")] = QVariant::fromValue(contactInfo.value(identifier.id));
             }
 
             contactAttributes[handle] = attributes;
@@ -862,7 +1165,9 @@ void MorseConnection::removeContacts(const Tp::UIntList &handles, Tp::DBusError
         ids.append(userId);
     }
 
-    m_client->contactsApi()->deleteContacts(ids);
+    m_bridge->post([this, ids]() {
+        m_client->contactsApi()->deleteContacts(ids);
+    });
 }
 
 Tp::ContactInfoFieldList MorseConnection::requestContactInfo(uint handle, Tp::DBusError *error)
@@ -884,67 +1189,56 @@ Tp::ContactInfoFieldList MorseConnection::requestContactInfo(uint handle, Tp::DB
 
 Tp::ContactInfoFieldList MorseConnection::getUserInfo(const quint32 userId) const
 {
-    Telegram::UserInfo userInfo;
-    if (!m_client->dataStorage()->getUserInfo(&userInfo, userId)) {
-        return Tp::ContactInfoFieldList();
-    }
+    return m_contactInfoCache->contactInfo(userId);
+}
 
-    Tp::ContactInfoFieldList contactInfo;
-    if (!userInfo.userName().isEmpty()) {
-        Tp::ContactInfoField contactInfoField;
-        contactInfoField.fieldName = QLatin1String("nickname");
-        contactInfoField.fieldValue.append(userInfo.userName());
-        contactInfo << contactInfoField;
-    }
-    if (!userInfo.phone().isEmpty()) {
-        Tp::ContactInfoField contactInfoField;
-        contactInfoField.fieldName = QLatin1String("tel");
-        QString phone = userInfo.phone();
-        if (!phone.startsWith(QLatin1Char('+'))) {
-            phone.prepend(QLatin1Char('+'));
-        }
-        contactInfoField.parameters.append(QLatin1String("type=text"));
-        contactInfoField.parameters.append(QLatin1String("type=cell"));
-        contactInfoField.fieldValue.append(phone);
-        contactInfo << contactInfoField;
-    }
+void MorseConnection::invalidateUserInfo(quint32 userId)
+{
+    m_contactInfoCache->invalidate(userId);
+    scheduleAliasUpdate(userId ? Telegram::Peer::fromUserId(userId) : Telegram::Peer());
+}
 
-    QString name = userInfo.firstName() + QLatin1Char(' ') + userInfo.lastName();
-    name = name.simplified();
-    if (!name.isEmpty()) {
-        Tp::ContactInfoField contactInfoField;
-        contactInfoField.fieldName = QLatin1String("fn"); // Formatted name
-        contactInfoField.fieldValue.append(name);
-        contactInfo << contactInfoField;
-    }
-    {
-        Tp::ContactInfoField contactInfoField;
-        contactInfoField.fieldName = QLatin1String("n");
-        contactInfoField.fieldValue.append(userInfo.lastName()); // "Surname"
-        contactInfoField.fieldValue.append(userInfo.firstName()); // "Given"
-        contactInfoField.fieldValue.append(QString()); // Additional
-        contactInfoField.fieldValue.append(QString()); // Prefix
-        contactInfoField.fieldValue.append(QString()); // Suffix
-        contactInfo << contactInfoField;
+void MorseConnection::updateUserInfo(const QVector<quint32> &userIds, const QVector<Telegram::UserInfo> &users)
+{
+    for (const quint32 userId : m_contactInfoCache->update(userIds, users)) {
+        scheduleAliasUpdate(Telegram::Peer::fromUserId(userId));
     }
-
-    return contactInfo;
 }
 
 Tp::ContactInfoMap MorseConnection::getContactInfo(const Tp::UIntList &contacts, Tp::DBusError *error)
 {
-    qDebug() << Q_FUNC_INFO << contacts;
+    MORSE_MONITOR_SCOPE();
+    qDebug() << Q_FUNC_INFO << contacts.count() << "contacts";
 
     if (contacts.isEmpty()) {
         return Tp::ContactInfoMap();
     }
 
-    Tp::ContactInfoMap result;
+    // Validate the whole batch first: an invalid handle fails the call as a whole
+    QVector<uint> userHandles;
+    QVector<quint32> userIds;
+    userHandles.reserve(contacts.count());
+    userIds.reserve(contacts.count());
+    for (const uint handle : contacts) {
+        const Telegram::Peer identifier = m_contactHandles.value(handle);
+        if (!identifier.isValid()) {
+            error->set(TP_QT_ERROR_INVALID_HANDLE, QStringLiteral("Invalid handle %1").arg(handle));
+            return Tp::ContactInfoMap();
+        }
+        // Other contacts (broadcast channels) have no contact info
+        if (identifier.type == Telegram::Peer::User) {
+            userHandles.append(handle);
+            userIds.append(identifier.id);
+        }
+    }
+
+    const QHash<quint32, Tp::ContactInfoFieldList> contactInfo = m_contactInfoCache->contactInfo(userIds);
 
-    foreach (uint handle, contacts) {
-        const Tp::ContactInfoFieldList contactInfo = requestContactInfo(handle, error);
-        if (!contactInfo.isEmpty()) {
-            result.insert(handle, contactInfo);
+    Tp::ContactInfoMap result;
+    for (int i = 0; i < userHandles.count(); ++i) {
+        const Tp::ContactInfoFieldList fields = contactInfo.value(userIds.at(i));
+        if (!fields.isEmpty()) {
+            result.insert(userHandles.at(i), fields);
         }
     }
 
@@ -953,12 +1247,23 @@ Tp::ContactInfoMap MorseConnection::getContactInfo(const Tp::UIntList &contacts,
 
 Tp::AliasMap MorseConnection::getAliases(const Tp::UIntList &handles, Tp::DBusError *error)
 {
+    MORSE_MONITOR_SCOPE();
     qDebug() << Q_FUNC_INFO << handles;
 
+    QVector<Telegram::Peer> peers;
+    peers.reserve(handles.count());
+    for (const uint handle : handles) {
+        const Telegram::Peer identifier = m_contactHandles.value(handle);
+        if (identifier.isValid()) {
+            peers.append(identifier);
+        }
+    }
+    fetchAliases(peers);
+
     Tp::AliasMap aliases;
 
     foreach (uint handle, handles) {
-        aliases[handle] = getContactAlias(handle);
+        aliases[handle] = m_aliases.value(m_contactHandles.value(handle));
     }
 
     return aliases;
@@ -974,19 +1279,100 @@ QString MorseConnection::getAlias(const Telegram::Peer identifier)
     if (!identifier.isValid()) {
         return QString();
     }
-    if (identifier.type == Telegram::Peer::User) {
-        Telegram::UserInfo info;
-        if (m_client->dataStorage()->getUserInfo(&info, identifier.id)) {
-            return info.getBestDisplayName();
+    const auto it = m_aliases.constFind(identifier);
+    if (it != m_aliases.constEnd()) {
+        return it.value();
+    }
+
+    const QString alias = m_bridge->getPeerNames({identifier}).first();
+    if (!alias.isEmpty()) {
+        m_aliases.insert(identifier, alias);
+    }
+    return alias;
+}
+
+void MorseConnection::fetchAliases(const QVector<Telegram::Peer> &peers)
+{
+    QVector<Telegram::Peer> missingPeers;
+    for (const Telegram::Peer &peer : peers) {
+        if (peer.isValid() && !m_aliases.contains(peer)) {
+            missingPeers.append(peer);
+        }
+    }
+    if (missingPeers.isEmpty()) {
+        return;
+    }
+    const QStringList names = m_bridge->getPeerNames(missingPeers);
+    for (int i = 0; i < missingPeers.count(); ++i) {
+        if (!names.at(i).isEmpty()) {
+            m_aliases.insert(missingPeers.at(i), names.at(i));
+        }
+    }
+}
+
+void MorseConnection::scheduleAliasUpdate(const Telegram::Peer &peer)
+{
+    if (peer.isValid()) {
+        // Nobody has seen the alias yet, so it can not be changed
+        if (!m_aliases.contains(peer)) {
+            return;
         }
+        m_staleAliases.insert(peer);
     } else {
-        Telegram::ChatInfo info;
-        if (m_client->dataStorage()->getChatInfo(&info, identifier)) {
-            return info.title();
+        for (auto it = m_aliases.constBegin(); it != m_aliases.constEnd(); ++it) {
+            m_staleAliases.insert(it.key());
+        }
+    }
+    if (m_staleAliases.isEmpty()) {
+        return;
+    }
+
+    if (!m_aliasUpdateTimer) {
+        m_aliasUpdateTimer = new QTimer(this);
+        m_aliasUpdateTimer->setSingleShot(true);
+        m_aliasUpdateTimer->setInterval(c_aliasUpdateDelay);
+        connect(m_aliasUpdateTimer, &QTimer::timeout, this, &MorseConnection::updateAliases);
+    }
+    // Do not restart an active timer, otherwise a busy group would postpone the update forever
+    if (!m_aliasUpdateTimer->isActive()) {
+        m_aliasUpdateTimer->start();
+    }
+}
+
+void MorseConnection::updateAliases()
+{
+    MORSE_MONITOR_SCOPE();
+    const QVector<Telegram::Peer> peers = m_staleAliases.toList().toVector();
+    m_staleAliases.clear();
+    const QStringList names = m_bridge->getPeerNames(peers);
+
+    Tp::AliasPairList changes;
+    for (int i = 0; i < peers.count(); ++i) {
+        const Telegram::Peer &peer = peers.at(i);
+        const QString &alias = names.at(i);
+        auto it = m_aliases.find(peer);
+        if (alias.isEmpty() || (it == m_aliases.end()) || (it.value() == alias)) {
+            continue;
+        }
+        it.value() = alias;
+
+        // Room titles are not aliases in terms of Telepathy
+        if (peer.type != Telegram::Peer::User) {
+            continue;
+        }
+        const uint handle = getContactHandle(peer);
+        if (handle) {
+            Tp::AliasPair change;
+            change.handle = handle;
+            change.alias = alias;
+            changes.append(change);
         }
     }
 
-    return QString();
+    if (!changes.isEmpty()) {
+        qDebug() << Q_FUNC_INFO << changes.count() << "aliases changed";
+        aliasingIface->aliasesChanged(changes);
+    }
 }
 
 Tp::SimplePresence MorseConnection::getPresence(uint handle)
@@ -1006,7 +1392,10 @@ uint MorseConnection::setPresence(const QString &status, const QString &message,
 
     m_wantedPresence = status;
 
-    if (m_client->connectionApi()->isSignedIn()) {
+    const bool signedIn = m_bridge->call<bool>([this]() {
+        return m_client->connectionApi()->isSignedIn();
+    });
+    if (signedIn) {
         //m_core->setOnlineStatus(status == c_onlineSimpleStatusKey);
     }
 
@@ -1033,6 +1422,9 @@ uint MorseConnection::ensureContact(const Telegram::Peer &identifier)
     if (!handle) {
         handle = addContacts( {identifier});
     }
+    if (handle != c_selfHandle) {
+        m_contactHandleUse.insert(handle, m_handleSweep);
+    }
     return handle;
 }
 
@@ -1040,20 +1432,108 @@ uint MorseConnection::ensureChat(const Telegram::Peer &identifier)
 {
     uint handle = getChatHandle(identifier);
     if (!handle) {
-        if (m_chatHandles.isEmpty()) {
-            handle = 1;
+        handle = ++m_lastChatHandle;
+        m_chatHandles.insert(handle, identifier);
+        m_chatHandleIds.insert(identifier, handle);
+        MorseMetrics::instance()->addToGauge(c_roomHandlesGauge, 1);
+    }
+    m_chatHandleUse.insert(handle, m_handleSweep);
+    return handle;
+}
+
+void MorseConnection::touchHandles(uint handleType, const Tp::UIntList &handles)
+{
+    QHash<uint, quint32> &handleUse = handleType == Tp::HandleTypeRoom ? m_chatHandleUse : m_contactHandleUse;
+    for (const uint handle : handles) {
+        const auto it = handleUse.find(handle);
+        if (it != handleUse.end()) {
+            it.value() = m_handleSweep;
+        }
+    }
+}
+
+/**
+ * Reclaims the handles of transient peers (e.g. senders in public groups)
+ *
+ * A handle is kept while it is on the roster, is a target or an initiator
+ * of a live channel, is a member of an open room or a sender of a pending
+ * message, or has been used (ensured, inspected or queried for the contact
+ * attributes) during the last c_handleIdleSweeps sweeps.
+ * The handle numbers are never reused, so a client holding a reclaimed
+ * handle gets InvalidHandle instead of another contact.
+ */
+void MorseConnection::reclaimHandles()
+{
+    MORSE_MONITOR_SCOPE();
+    ++m_handleSweep;
+    if (m_handleSweep <= c_handleIdleSweeps) {
+        return;
+    }
+    const quint32 idleSweep = m_handleSweep - c_handleIdleSweeps;
+
+    QSet<uint> usedContacts;
+    QSet<uint> usedChats;
+    for (const uint handle : m_contactList) {
+        usedContacts.insert(handle);
+    }
+    for (const Tp::ChannelDetails &details : channelsDetails()) {
+        const uint targetHandle = details.properties.value(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle")).toUInt();
+        const uint targetHandleType = details.properties.value(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType")).toUInt();
+        if (targetHandleType == Tp::HandleTypeRoom) {
+            usedChats.insert(targetHandle);
         } else {
-            handle = m_chatHandles.keys().last() + 1;
+            usedContacts.insert(targetHandle);
+        }
+        usedContacts.insert(details.properties.value(TP_QT_IFACE_CHANNEL + QLatin1String(".InitiatorHandle")).toUInt());
+    }
+    for (const QPointer<MorseTextChannel> &channel : m_textChannels) {
+        if (channel) {
+            usedContacts.unite(channel->referencedHandles());
         }
+    }
 
-        m_chatHandles.insert(handle, identifier);
+    int contactsCount = 0;
+    for (auto it = m_contactHandleUse.begin(); it != m_contactHandleUse.end(); ) {
+        if ((it.value() > idleSweep) || usedContacts.contains(it.key())) {
+            ++it;
+            continue;
+        }
+        const Telegram::Peer peer = m_contactHandles.take(it.key());
+        m_contactHandleIds.remove(peer);
+        m_publishedStatuses.remove(it.key());
+        m_aliases.remove(peer);
+        m_staleAliases.remove(peer);
+        if (peer.type == Telegram::Peer::User) {
+            m_contactInfoCache->invalidate(peer.id);
+        }
+        it = m_contactHandleUse.erase(it);
+        ++contactsCount;
+    }
+
+    int chatsCount = 0;
+    for (auto it = m_chatHandleUse.begin(); it != m_chatHandleUse.end(); ) {
+        if ((it.value() > idleSweep) || usedChats.contains(it.key())) {
+            ++it;
+            continue;
+        }
+        const Telegram::Peer peer = m_chatHandles.take(it.key());
+        m_chatHandleIds.remove(peer);
+        m_aliases.remove(peer);
+        m_staleAliases.remove(peer);
+        it = m_chatHandleUse.erase(it);
+        ++chatsCount;
+    }
+
+    if (contactsCount || chatsCount) {
+        qDebug() << Q_FUNC_INFO << "Reclaimed" << contactsCount << "contact and" << chatsCount << "room handles";
+        MorseMetrics::instance()->addToGauge(c_contactHandlesGauge, -contactsCount);
+        MorseMetrics::instance()->addToGauge(c_roomHandlesGauge, -chatsCount);
     }
-    return handle;
 }
 
 Telegram::Peer MorseConnection::selfPeer() const
 {
-    return Peer::fromUserId(m_client->dataStorage()->selfUserId());
+    return Peer::fromUserId(m_bridge->selfUserId());
 }
 
 quint64 MorseConnection::getSentMessageToken(const Peer &dialog, quint32 messageId) const
@@ -1079,12 +1559,6 @@ QString MorseConnection::getMessageToken(const Peer &dialog, quint32 messageId)
 uint MorseConnection::addContacts(const QVector<Telegram::Peer> &identifiers)
 {
     qDebug() << Q_FUNC_INFO;
-    uint handle = 0;
-
-    if (!m_contactHandles.isEmpty()) {
-        handle = m_contactHandles.keys().last();
-    }
-
     QList<uint> newHandles;
     QVector<Telegram::Peer> newIdentifiers;
     for (const Telegram::Peer &identifier : identifiers) {
@@ -1092,13 +1566,16 @@ uint MorseConnection::addContacts(const QVector<Telegram::Peer> &identifiers)
             continue;
         }
 
-        ++handle;
+        const uint handle = ++m_lastContactHandle;
         m_contactHandles.insert(handle, identifier);
+        m_contactHandleIds.insert(identifier, handle);
+        m_contactHandleUse.insert(handle, m_handleSweep);
         newHandles << handle;
         newIdentifiers << identifier;
     }
+    MorseMetrics::instance()->addToGauge(c_contactHandlesGauge, newHandles.count());
 
-    return handle;
+    return m_lastContactHandle;
 }
 
 void MorseConnection::updateContactsPresence(const QVector<Telegram::Peer> &identifiers)
@@ -1118,18 +1595,33 @@ void MorseConnection::updateContactsPresence(const QVector<Telegram::Peer> &iden
             // We list broadcast channels as Contacts
             if (identifier.type == Telegram::Peer::User) {
                 Telegram::UserInfo info;
-                m_client->dataStorage()->getUserInfo(&info, identifier.id);
+                m_bridge->getUserInfo(&info, identifier.id);
                 st = info.status();
             }
         }
 
+        const auto published = m_publishedStatuses.constFind(handle);
+        if ((published != m_publishedStatuses.constEnd()) && (published.value() == st)) {
+            continue;
+        }
+        m_publishedStatuses.insert(handle, st);
         newPresences[handle] = telegramStatusToTelepathyPresence(st);
     }
-    simplePresenceIface->setPresences(newPresences);
+    if (!newPresences.isEmpty()) {
+        simplePresenceIface->setPresences(newPresences);
+    }
 }
 
 void MorseConnection::updateSelfContactState(Tp::ConnectionStatus status)
 {
+    const Namespace::ContactStatus selfStatus = (status == Tp::ConnectionStatusConnected) ? Namespace::ContactStatusOnline
+                                                                                         : Namespace::ContactStatusOffline;
+    const auto published = m_publishedStatuses.constFind(selfHandle());
+    if ((published != m_publishedStatuses.constEnd()) && (published.value() == selfStatus)) {
+        return;
+    }
+    m_publishedStatuses.insert(selfHandle(), selfStatus);
+
     Tp::SimpleContactPresences newPresences;
     Tp::SimplePresence presence;
     if (status == Tp::ConnectionStatusConnected) {
@@ -1153,6 +1645,8 @@ void MorseConnection::onSyncMessagesReceived(const Peer &peer, const QVector<qui
     QVector<quint32> reversedMessages = messages;
     std::reverse(reversedMessages.begin(), reversedMessages.end());
     addMessages(peer, reversedMessages);
+
+    m_syncScheduler->onPeerSynced(peer);
 }
 
 /* Receive message from outside (telegram server) */
@@ -1163,35 +1657,73 @@ void MorseConnection::onNewMessageReceived(const Peer peer, quint32 messageId)
 
 void MorseConnection::addMessages(const Peer peer, const QVector<quint32> &messageIds)
 {
+    MORSE_MONITOR_SCOPE();
     QVector<quint32> newIds = messageIds;
     if (newIds.isEmpty()) {
         return;
     }
 
+    const bool isRoom = peerIsRoom(peer);
+    if (isRoom) {
+        // Service messages can change the room title or members, also of the rooms without a channel
+        invalidateRoomSummary(peer);
+    }
+
     MorseTextChannelPtr textChannel = ensureTextChannel(peer);
 
     if (!textChannel) {
         return;
     }
 
+    if (isRoom) {
+        // The room could be opened before the connection became ready
+        m_syncScheduler->requestLazySync(peer);
+    }
+
+    QSet<quint32> senderIds;
     for (const quint32 messageId : newIds) {
         Telegram::Message message;
-        m_client->dataStorage()->getMessage(&message, peer, messageId);
+        m_bridge->getMessage(&message, peer, messageId);
+        if (message.fromUserId()) {
+            senderIds.insert(message.fromUserId());
+        }
         textChannel->onMessageReceived(message);
     }
+
+    // The messages come with the current sender data
+    if (!senderIds.isEmpty()) {
+        QVector<quint32> userIds = senderIds.toList().toVector();
+        const QVector<Telegram::UserInfo> users = m_bridge->getUserInfos(&userIds);
+        updateUserInfo(userIds, users);
+    }
+
+    quint32 &deliveredMessageId = m_deliveredMessageIds[peer];
+    deliveredMessageId = qMax(deliveredMessageId, *std::max_element(newIds.constBegin(), newIds.constEnd()));
 }
 
 void MorseConnection::updateContactList()
 {
-    if (m_client->connectionApi()->status() != Client::ConnectionApi::StatusReady) {
-        return;
-    }
+    bool ready = false;
+    const QVector<Telegram::Peer> peers = m_bridge->call<QVector<Telegram::Peer>>([this, &ready]() {
+        if (m_client->connectionApi()->status() != Client::ConnectionApi::StatusReady) {
+            return QVector<Telegram::Peer>();
+        }
+        ready = true;
 #ifdef DIALOGS_AS_CONTACTLIST
-    const QVector<Telegram::Peer> ids = m_dialogs->peers();
+        return m_dialogs->peers();
 #else
-    const QVector<Telegram::Peer> ids = m_contacts->peers();
+        return m_contacts->peers();
 #endif
+    });
+    if (!ready) {
+        return;
+    }
+    setContactList(peers);
+}
 
+void MorseConnection::setContactList(const QVector<Telegram::Peer> &ids)
+{
+    MORSE_MONITOR_SCOPE();
     qDebug() << this << __func__ << "ids:" << ids;
 
     QVector<uint> newContactListHandles;
@@ -1199,25 +1731,40 @@ void MorseConnection::updateContactList()
     newContactListHandles.reserve(ids.count());
     newContactListIdentifiers.reserve(ids.count());
 
+    QVector<quint32> userIds;
+    userIds.reserve(ids.count());
+    for (const Telegram::Peer &peer : ids) {
+        if (peer.type == Telegram::Peer::User) {
+            userIds.append(peer.id);
+        }
+    }
+    const QVector<Telegram::UserInfo> users = m_bridge->getUserInfos(&userIds);
+    updateUserInfo(userIds, users);
+    QSet<quint32> deletedUserIds;
+    for (int i = 0; i < users.count(); ++i) {
+        if (users.at(i).isDeleted()) {
+            deletedUserIds.insert(userIds.at(i));
+        }
+    }
+
     for (const Telegram::Peer &peer : ids) {
         if (peerIsRoom(peer)) {
             continue;
         }
-        Telegram::UserInfo info;
-        if (peer.type == Telegram::Peer::User) {
-            m_client->dataStorage()->getUserInfo(&info, peer.id);
-            if (info.isDeleted()) {
-                qDebug() << this << __func__ << "skip deleted user id" << peer.id;
-                continue;
-            }
+        if ((peer.type == Telegram::Peer::User) && deletedUserIds.contains(peer.id)) {
+            qDebug() << this << __func__ << "skip deleted user id" << peer.id;
+            continue;
         }
         newContactListIdentifiers.append(peer);
         newContactListHandles.append(ensureContact(newContactListIdentifiers.last()));
     }
 
+    const QSet<uint> oldHandles = m_contactList.toList().toSet();
+    const QSet<uint> newHandles = newContactListHandles.toList().toSet();
+
     Tp::HandleIdentifierMap removals;
     foreach (uint handle, m_contactList) {
-        if (newContactListHandles.contains(handle)) {
+        if (newHandles.contains(handle)) {
             continue;
         }
         const Telegram::Peer identifier = m_contactHandles.value(handle);
@@ -1234,7 +1781,11 @@ void MorseConnection::updateContactList()
     Tp::ContactSubscriptionMap changes;
     Tp::HandleIdentifierMap identifiersMap;
 
+    // Only the delta to the already published roster
     for (int i = 0; i < newContactListIdentifiers.size(); ++i) {
+        if (oldHandles.contains(newContactListHandles.at(i))) {
+            continue;
+        }
         Tp::ContactSubscriptions change;
         change.publish = Tp::SubscriptionStateYes;
         change.subscribe = Tp::SubscriptionStateYes;
@@ -1242,18 +1793,50 @@ void MorseConnection::updateContactList()
         identifiersMap[newContactListHandles[i]] = newContactListIdentifiers.at(i).toString();
     }
 
-    contactListIface->contactsChangedWithID(changes, identifiersMap, removals);
+    if (!changes.isEmpty() || !removals.isEmpty()) {
+        contactListIface->contactsChangedWithID(changes, identifiersMap, removals);
+    }
 
     updateContactsPresence(newContactListIdentifiers);
 
+    // The storage has the live user data now
+    m_snapshotAvatarTokens.clear();
     contactListIface->setContactListState(Tp::ContactListStateSuccess);
+    m_contactListPublished = true;
+
+    // Do not lose the roster if the process does not reach saveState() on the disconnect
+    if (!m_rosterSaveTimer) {
+        m_rosterSaveTimer = new QTimer(this);
+        m_rosterSaveTimer->setSingleShot(true);
+        m_rosterSaveTimer->setInterval(c_rosterSaveDelay);
+        connect(m_rosterSaveTimer, &QTimer::timeout, this, &MorseConnection::saveRosterSnapshot);
+    }
+    // Do not restart an active timer, otherwise frequent changes would postpone the save forever
+    if (!m_rosterSaveTimer->isActive()) {
+        m_rosterSaveTimer->start();
+    }
+}
+
+void MorseConnection::saveRosterSnapshot()
+{
+    MORSE_MONITOR_SCOPE();
+    const quint32 selfUserId = m_contactHandles.value(c_selfHandle).id;
+    const QVector<MorseDataStorage::RosterEntry> roster = getRosterSnapshot();
+    m_bridge->run([this, selfUserId, &roster]() {
+        m_dataStorage->setRoster(selfUserId, roster);
+        m_dataStorage->saveRoster();
+    });
 }
 
 void MorseConnection::onDialogsReady()
 {
+    MORSE_MONITOR_SCOPE();
     bool m_omitGroupChats = true;
     Telegram::PeerList interestingPeers;
-    for (const Telegram::Peer &peer : m_dialogs->peers()) {
+    const QVector<Telegram::Peer> dialogs = m_bridge->call<QVector<Telegram::Peer>>([this]() {
+        return m_dialogs->peers();
+    });
+    for (const Telegram::Peer &peer : dialogs) {
         if (m_omitGroupChats) {
             if (peerIsRoom(peer)) {
                 continue;
@@ -1261,7 +1844,22 @@ void MorseConnection::onDialogsReady()
         }
         interestingPeers.append(peer);
     }
-    m_client->messagingApi()->syncPeers(interestingPeers);
+
+    if (m_dialogsSynced) {
+        // Resumed after a reconnect: the client has already fetched the updates difference
+        // and the channels keep their history, so only the dialogs with undelivered messages need a sync
+        const QVector<quint32> lastMessageIds = m_bridge->getLastMessageIds(interestingPeers);
+        Telegram::PeerList stalePeers;
+        for (int i = 0; i < interestingPeers.count(); ++i) {
+            if (lastMessageIds.at(i) > m_deliveredMessageIds.value(interestingPeers.at(i))) {
+                stalePeers.append(interestingPeers.at(i));
+            }
+        }
+        qDebug() << Q_FUNC_INFO << "Resumed with" << stalePeers.count() << "of" << interestingPeers.count() << "dialogs to sync";
+        interestingPeers = stalePeers;
+    }
+    m_dialogsSynced = true;
+    m_syncScheduler->schedule(interestingPeers);
 
     updateContactList();
 }
@@ -1269,12 +1867,17 @@ void MorseConnection::onDialogsReady()
 void MorseConnection::onDisconnected()
 {
     qDebug() << Q_FUNC_INFO;
+    m_syncScheduler->stop();
+    m_outgoingQueue->setOnline(false);
     saveState();
-    m_client->connectionApi()->disconnectFromServer();
+    m_bridge->post([this]() {
+        m_client->connectionApi()->disconnectFromServer();
+    });
 }
 
 void MorseConnection::onAvatarRequestFinished(Telegram::Client::FileOperation *fileOperation, const Peer &peer)
 {
+    MORSE_MONITOR_SCOPE();
     const Telegram::FileInfo *fileInfo = fileOperation->fileInfo();
     const QString fileId = fileInfo->getFileId();
     qDebug() << Q_FUNC_INFO << fileId << fileOperation;
@@ -1301,7 +1904,145 @@ void MorseConnection::onAvatarRequestFinished(Telegram::Client::FileOperation *f
     }
 }
 
-void MorseConnection::onMessageSent(const Peer &peer, quint64 messageRandomId, quint32 messageId)
+QString MorseConnection::uploadsDirectory() const
+{
+    const QString directory = m_info->accountCacheDirectory();
+    if (directory.isEmpty()) {
+        return QString();
+    }
+    return directory + QLatin1String("/uploads");
+}
+
+void MorseConnection::uploadFile(const Peer &peer, const QString &filePath, const QString &fileName, const QString &contentType)
+{
+    MORSE_MONITOR_SCOPE();
+    // The client reads the file part by part, so it is never loaded into memory as a whole
+    Client::FileOperation *fileOperation = m_bridge->call<Client::FileOperation *>([this, &peer, &filePath, &fileName]() -> Client::FileOperation * {
+        QFile *source = new QFile(filePath);
+        if (!source->open(QIODevice::ReadOnly)) {
+            delete source;
+            return nullptr;
+        }
+        Client::FileOperation *operation = m_client->filesApi()->uploadFile(source, fileName);
+        source->setParent(operation);
+        operation->connectToFinished(this, &MorseConnection::onFileUploadFinished, operation, peer);
+        return operation;
+    });
+
+    // The client has already seen the transfer completed, so the delivery is reported to the text channel
+    const quint64 token = m_outgoingQueue->reserveToken();
+    if (!fileOperation) {
+        qWarning() << Q_FUNC_INFO << "Unable to open file" << filePath;
+        QFile::remove(filePath);
+        onMessageFailed(peer, token);
+        return;
+    }
+
+    FileUpload upload;
+    upload.filePath = filePath;
+    upload.contentType = contentType;
+    upload.token = token;
+    m_fileUploads.insert(fileOperation, upload);
+}
+
+/**
+ * Offer the media file of a received message as an incoming file transfer
+ *
+ * \return true if the file transfer channel is created
+ */
+bool MorseConnection::offerFile(const Peer &sender, const MessageMediaInfo &info, Namespace::MessageType type, uint timestamp)
+{
+#ifdef ENABLE_FILE_TRANSFER
+    MORSE_MONITOR_SCOPE();
+    Telegram::FileInfo remoteFile;
+    if (!info.getRemoteFileInfo(&remoteFile) || !remoteFile.isValid()) {
+        qWarning() << Q_FUNC_INFO << "Unable to get the remote file from" << sender.toString();
+        return false;
+    }
+
+    QString contentType = info.mimeType();
+    QString fileName = info.documentFileName();
+    if (type == Namespace::MessageTypePhoto) {
+        if (contentType.isEmpty()) {
+            contentType = QLatin1String("image/jpeg");
+        }
+        if (fileName.isEmpty()) {
+            fileName = QStringLiteral("photo-%1.jpg").arg(timestamp);
+        }
+    }
+    if (contentType.isEmpty()) {
+        contentType = QLatin1String("application/octet-stream");
+    }
+    if (fileName.isEmpty()) {
+        fileName = QStringLiteral("file-%1").arg(timestamp);
+    }
+
+    const uint senderHandle = ensureContact(sender);
+    QVariantMap request;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType")] = TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType")] = Tp::HandleTypeContact;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle")] = senderHandle;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".InitiatorHandle")] = senderHandle;
+    request[TP_QT_IFACE_CHANNEL + QLatin1String(".Requested")] = false;
+    request[TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".ContentType")] = contentType;
+    request[TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".Filename")] = fileName;
+    request[TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".Size")] = static_cast<qulonglong>(info.size());
+    request[TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER + QLatin1String(".Date")] = QDateTime::fromTime_t(timestamp);
+
+    Tp::BaseChannelPtr baseChannel = Tp::BaseChannel::create(this, TP_QT_IFACE_CHANNEL_TYPE_FILE_TRANSFER,
+                                                             Tp::HandleTypeContact, senderHandle);
+    baseChannel->setTargetID(sender.toString());
+    baseChannel->setInitiatorHandle(senderHandle);
+    baseChannel->setRequested(false);
+
+    MorseFileTransferChannelPtr fileTransferChannel = MorseFileTransferChannel::createIncoming(this, baseChannel.data(),
+                                                                                               request, remoteFile);
+    baseChannel->plugInterface(Tp::AbstractChannelInterfacePtr::dynamicCast(fileTransferChannel));
+
+    Tp::DBusError error;
+    baseChannel->registerObject(&error);
+    if (error.isValid()) {
+        qWarning() << Q_FUNC_INFO << error.name() << error.message();
+        return false;
+    }
+    addChannel(baseChannel);
+    return true;
+#else
+    Q_UNUSED(sender)
+    Q_UNUSED(info)
+    Q_UNUSED(type)
+    Q_UNUSED(timestamp)
+    return false;
+#endif // ENABLE_FILE_TRANSFER
+}
+
+void MorseConnection::onFileUploadFinished(Client::FileOperation *fileOperation, const Peer &peer)
+{
+    MORSE_MONITOR_SCOPE();
+    const FileUpload upload = m_fileUploads.take(fileOperation);
+    QFile::remove(upload.filePath);
+
+    if (fileOperation->isFailed()) {
+        qWarning() << Q_FUNC_INFO << "Upload failed:" << fileOperation->errorDetails();
+        onMessageFailed(peer, upload.token);
+    } else {
+        const Namespace::MessageType type = upload.contentType.startsWith(QLatin1String("image/"))
+                ? Namespace::MessageTypePhoto
+                : Namespace::MessageTypeDocument;
+        Telegram::MessageMediaInfo mediaInfo;
+        mediaInfo.setUploadFile(type, *fileOperation->fileInfo());
+        mediaInfo.setMimeType(upload.contentType);
+
+        // Rate limited, retried and reported like the text messages
+        m_outgoingQueue->enqueueMedia(peer, mediaInfo, upload.token);
+    }
+
+    m_bridge->post([fileOperation]() {
+        fileOperation->deleteLater();
+    });
+}
+
+void MorseConnection::onMessageSent(const Peer &peer, quint64 token, quint32 messageId)
 {
     MorseTextChannelPtr textChannel = ensureTextChannel(peer);
 
@@ -1309,9 +2050,20 @@ void MorseConnection::onMessageSent(const Peer &peer, quint64 messageRandomId, q
         return;
     }
 
-    m_sentMessageMap[peer].insert(messageId, messageRandomId);
+    m_sentMessageMap[peer].insert(messageId, token);
+
+    textChannel->onMessageSent(token, messageId);
+}
+
+void MorseConnection::onMessageFailed(const Peer &peer, quint64 token)
+{
+    MorseTextChannelPtr textChannel = ensureTextChannel(peer);
+
+    if (!textChannel) {
+        return;
+    }
 
-    textChannel->onMessageSent(messageRandomId, messageId);
+    textChannel->onMessageFailed(token);
 }
 
 void MorseConnection::onContactStatusChanged(quint32 userId, Namespace::ContactStatus status)
@@ -1321,29 +2073,66 @@ void MorseConnection::onContactStatusChanged(quint32 userId, Namespace::ContactS
         // Ignore self contact status changes
         return;
     }
+    m_publishedStatuses.insert(handle, status);
     Tp::SimpleContactPresences newPresences;
     newPresences[handle] = telegramStatusToTelepathyPresence(status);
     simplePresenceIface->setPresences(newPresences);
 }
 
+MorseTextChannel *MorseConnection::textChannel(const Telegram::Peer &peer) const
+{
+    return m_textChannels.value(peer).data();
+}
+
+void MorseConnection::onMessageActionChanged(const Telegram::Peer &peer, quint32 userId, const Telegram::MessageAction &action)
+{
+    if (MorseTextChannel *channel = textChannel(peer)) {
+        channel->setMessageAction(userId, action);
+    }
+}
+
+void MorseConnection::onMessageReadInbox(const Telegram::Peer &peer, quint32 messageId)
+{
+    if (MorseTextChannel *channel = textChannel(peer)) {
+        channel->setMessageInboxRead(peer, messageId);
+    }
+}
+
+void MorseConnection::onMessageReadOutbox(const Telegram::Peer &peer, quint32 messageId)
+{
+    if (MorseTextChannel *channel = textChannel(peer)) {
+        channel->setMessageOutboxRead(peer, messageId);
+    }
+}
+
+void MorseConnection::onChatDetailsChanged(quint32 chatId, const Tp::UIntList &handles)
+{
+    // The signal carries only the id, which is either a legacy chat or a channel (supergroup) one
+    for (const Telegram::Peer &peer : { Telegram::Peer::fromChatId(chatId), Telegram::Peer::fromChannelId(chatId) }) {
+        MorseTextChannel *channel = textChannel(peer);
+        if (channel && peerIsRoom(peer)) {
+            channel->onChatDetailsChanged(chatId, handles);
+            return;
+        }
+    }
+}
+
 void MorseConnection::onGotRooms()
 {
-    qDebug() << Q_FUNC_INFO;
+    MORSE_MONITOR_SCOPE();
+    const int chunkEnd = qMin(m_roomListPosition + c_roomListChunkSize, m_roomListQueue.count());
+    qDebug() << Q_FUNC_INFO << m_roomListPosition << "-" << chunkEnd << "of" << m_roomListQueue.count();
     Tp::RoomInfoList rooms;
 
-    const QVector<Telegram::Peer> dialogs = m_client->dataStorage()->dialogs();
-    for(const Telegram::Peer peer : dialogs) {
-        if (!peerIsRoom(peer)) {
+    for (; m_roomListPosition < chunkEnd; ++m_roomListPosition) {
+        const Telegram::Peer chatID = m_roomListQueue.at(m_roomListPosition);
+        if (!peerIsRoom(chatID)) {
             continue;
         }
-        Telegram::ChatInfo chatInfo;
-        if (!m_client->dataStorage()->getChatInfo(&chatInfo, peer)) {
+        RoomSummary summary;
+        if (!getRoomSummary(chatID, &summary) || !summary.listed) {
             continue;
         }
-        if (chatInfo.migratedTo().isValid()) {
-            continue;
-        }
-        const Telegram::Peer chatID = peer;
         Tp::RoomInfo roomInfo;
         roomInfo.channelType = TP_QT_IFACE_CHANNEL_TYPE_TEXT;
         roomInfo.handle = ensureChat(chatID);
@@ -1351,13 +2140,51 @@ void MorseConnection::onGotRooms()
         roomInfo.info[QLatin1String("members-only")] = true;
         roomInfo.info[QLatin1String("invite-only")] = true;
         roomInfo.info[QLatin1String("password")] = false;
-        roomInfo.info[QLatin1String("name")] = chatInfo.title();
-        roomInfo.info[QLatin1String("members")] = chatInfo.participantsCount();
+        roomInfo.info[QLatin1String("name")] = summary.title;
+        roomInfo.info[QLatin1String("members")] = summary.participantsCount;
         rooms << roomInfo;
     }
 
-    roomListChannel->gotRooms(rooms);
-    roomListChannel->setListingRooms(false);
+    if (!rooms.isEmpty()) {
+        roomListChannel->gotRooms(rooms);
+    }
+
+    if (m_roomListPosition < m_roomListQueue.count()) {
+        m_roomListTimer->start();
+    } else {
+        m_roomListQueue.clear();
+        m_roomListPosition = 0;
+        roomListChannel->setListingRooms(false);
+    }
+}
+
+bool MorseConnection::getRoomSummary(const Telegram::Peer &peer, RoomSummary *summary)
+{
+    const auto it = m_roomSummaries.constFind(peer);
+    if (it != m_roomSummaries.constEnd()) {
+        *summary = it.value();
+        return true;
+    }
+
+    Telegram::ChatInfo chatInfo;
+    if (!m_bridge->getChatInfo(&chatInfo, peer)) {
+        return false;
+    }
+    summary->title = chatInfo.title();
+    summary->participantsCount = chatInfo.participantsCount();
+    summary->listed = !chatInfo.migratedTo().isValid();
+    m_roomSummaries.insert(peer, *summary);
+    return true;
+}
+
+void MorseConnection::invalidateRoomSummary(const Telegram::Peer &peer)
+{
+    scheduleAliasUpdate(peer);
+    if (peer.isValid()) {
+        m_roomSummaries.remove(peer);
+    } else {
+        m_roomSummaries.clear();
+    }
 }
 
 Tp::BaseChannelPtr MorseConnection::createRoomListChannel()
@@ -1383,31 +2210,61 @@ Tp::AvatarTokenMap MorseConnection::getKnownAvatarTokens(const Tp::UIntList &con
         error->set(TP_QT_ERROR_DISCONNECTED, QLatin1String("Disconnected"));
     }
 
-    Tp::AvatarTokenMap result;
-    Telegram::UserInfo userInfo;
-    Telegram::FileInfo pictureFile;
+    QVector<Telegram::Peer> peers;
+    peers.reserve(contacts.count());
     for (quint32 handle : contacts) {
         if (!m_contactHandles.contains(handle)) {
             error->set(TP_QT_ERROR_INVALID_HANDLE, QLatin1String("Invalid handle(s)"));
         }
+        peers.append(m_contactHandles.value(handle));
+    }
+    const QHash<Telegram::Peer, QString> avatarTokens = getAvatarTokens(peers);
 
-        const Peer peer = m_contactHandles.value(handle);
-        if (!m_client->dataStorage()->getUserInfo(&userInfo, peer.id)) {
-            qWarning() << "requestAvatars(): Unable to get userInfo for" << peer.toString();
-            continue;
-        }
-        if (!userInfo.getPeerPicture(&pictureFile, Telegram::PeerPictureSize::Small)) {
-            continue;
+    Tp::AvatarTokenMap result;
+    for (quint32 handle : contacts) {
+        const QString avatarToken = avatarTokens.value(m_contactHandles.value(handle));
+        if (!avatarToken.isEmpty()) {
+            result.insert(handle, avatarToken);
         }
-
-        result.insert(handle, pictureFile.getFileId());
     }
 
     return result;
 }
 
+QHash<Telegram::Peer, QString> MorseConnection::getAvatarTokens(const QVector<Telegram::Peer> &peers)
+{
+    QVector<quint32> userIds;
+    userIds.reserve(peers.count());
+    for (const Telegram::Peer &peer : peers) {
+        if (peer.isValid() && peer.type == Telegram::Peer::User) {
+            userIds.append(peer.id);
+        }
+    }
+    const QVector<Telegram::UserInfo> users = m_bridge->getUserInfos(&userIds);
+
+    QHash<Telegram::Peer, QString> tokens;
+    tokens.reserve(peers.count());
+    for (int i = 0; i < users.count(); ++i) {
+        Telegram::FileInfo pictureFile;
+        if (users.at(i).getPeerPicture(&pictureFile, Telegram::PeerPictureSize::Small)) {
+            tokens.insert(Telegram::Peer::fromUserId(userIds.at(i)), pictureFile.getFileId());
+        }
+    }
+    // The data storage can lack the users of the last known roster
+    for (const Telegram::Peer &peer : peers) {
+        if (!tokens.contains(peer)) {
+            const QString token = m_snapshotAvatarTokens.value(peer);
+            if (!token.isEmpty()) {
+                tokens.insert(peer, token);
+            }
+        }
+    }
+    return tokens;
+}
+
 void MorseConnection::requestAvatars(const Tp::UIntList &contacts, Tp::DBusError *error)
 {
+    MORSE_MONITOR_SCOPE();
     if (contacts.isEmpty()) {
         error->set(TP_QT_ERROR_INVALID_ARGUMENT, QLatin1String("No handles provided"));
     }
@@ -1422,7 +2279,7 @@ void MorseConnection::requestAvatars(const Tp::UIntList &contacts, Tp::DBusError
         }
         const Telegram::Peer peer = m_contactHandles.value(handle);
         Telegram::UserInfo userInfo;
-        if (!m_client->dataStorage()->getUserInfo(&userInfo, peer.id)) {
+        if (!m_bridge->getUserInfo(&userInfo, peer.id)) {
             qWarning() << "requestAvatars(): Unable to get userInfo for" << peer.toString();
             continue;
         }
@@ -1433,9 +2290,11 @@ void MorseConnection::requestAvatars(const Tp::UIntList &contacts, Tp::DBusError
             continue;
         }
 
-        Telegram::Client::FileOperation *fileOperation = m_client->filesApi()->downloadFile(&pictureFile);
-        fileOperation->connectToFinished(this, &MorseConnection::onAvatarRequestFinished,
-                              fileOperation, peer);
+        m_bridge->post([this, pictureFile, peer]() mutable {
+            Telegram::Client::FileOperation *fileOperation = m_client->filesApi()->downloadFile(&pictureFile);
+            fileOperation->connectToFinished(this, &MorseConnection::onAvatarRequestFinished,
+                                  fileOperation, peer);
+        });
 
         m_peerPictureRequests.insert(pictureFile.getFileId(), peer);
     }
@@ -1445,25 +2304,67 @@ void MorseConnection::roomListStartListing(Tp::DBusError *error)
 {
     Q_UNUSED(error)
 
-    QTimer::singleShot(0, this, SLOT(onGotRooms()));
+    if (!m_roomListTimer) {
+        m_roomListTimer = new QTimer(this);
+        m_roomListTimer->setSingleShot(true);
+        m_roomListTimer->setInterval(0);
+        connect(m_roomListTimer, &QTimer::timeout, this, &MorseConnection::onGotRooms);
+    }
+
+    // The rooms are streamed in chunks, one chunk per event loop iteration
+    m_roomListQueue = m_bridge->dialogs();
+    m_roomListPosition = 0;
+    m_roomListTimer->start();
     roomListChannel->setListingRooms(true);
 }
 
 void MorseConnection::roomListStopListing(Tp::DBusError *error)
 {
     Q_UNUSED(error)
+    if (m_roomListTimer) {
+        m_roomListTimer->stop();
+    }
+    m_roomListQueue.clear();
+    m_roomListPosition = 0;
     roomListChannel->setListingRooms(false);
 }
 
 void MorseConnection::loadState()
 {
-    m_dataStorage->loadData();
+    MORSE_MONITOR_SCOPE();
+    m_bridge->run([this]() {
+        m_dataStorage->loadData();
+    });
+    m_outgoingQueue->loadData();
+
+    // The spool files left by the uploads interrupted by a crash
+    const QString uploadsPath = uploadsDirectory();
+    if (uploadsPath.isEmpty()) {
+        return;
+    }
+    QDir uploads(uploadsPath);
+    for (const QString &fileName : uploads.entryList(QDir::Files)) {
+        uploads.remove(fileName);
+    }
 }
 
 void MorseConnection::saveState()
 {
-    m_client->accountStorage()->sync();
-    m_dataStorage->saveData();
+    MORSE_MONITOR_SCOPE();
+    const bool hasRoster = m_contactListPublished;
+    const quint32 selfUserId = m_contactHandles.value(c_selfHandle).id;
+    const QVector<MorseDataStorage::RosterEntry> roster = hasRoster ? getRosterSnapshot() : QVector<MorseDataStorage::RosterEntry>();
+    if (m_rosterSaveTimer) {
+        m_rosterSaveTimer->stop();
+    }
+    m_bridge->run([this, hasRoster, selfUserId, &roster]() {
+        m_client->accountStorage()->sync();
+        // Keep the previous roster if there was no one this time
+        if (hasRoster) {
+            m_dataStorage->setRoster(selfUserId, roster);
+        }
+        m_dataStorage->saveData();
+    });
 }
 
 bool MorseConnection::peerIsRoom(const Telegram::Peer peer) const
@@ -1471,25 +2372,37 @@ bool MorseConnection::peerIsRoom(const Telegram::Peer peer) const
     if (peer.type == Telegram::Peer::User) {
         return false;
     }
-#ifdef BROADCAST_AS_CONTACT
-    if (peer.type == Telegram::Peer::Channel) {
-        Telegram::ChatInfo info;
-        if (m_client->dataStorage()->getChatInfo(&info, peer)) {
-            if (info.broadcast()) {
-                return false;
-            }
-        }
+    if (m_broadcastAsContact && peerIsBroadcast(peer)) {
+        return false;
     }
-#endif
     return true;
 }
 
+bool MorseConnection::peerIsBroadcast(const Telegram::Peer &peer) const
+{
+    if (peer.type != Telegram::Peer::Channel) {
+        return false;
+    }
+    const auto it = m_broadcastChannels.constFind(peer.id);
+    if (it != m_broadcastChannels.constEnd()) {
+        return it.value();
+    }
+
+    Telegram::ChatInfo info;
+    if (!m_bridge->getChatInfo(&info, peer)) {
+        // Not cached: the channel can become known later
+        return false;
+    }
+    m_broadcastChannels.insert(peer.id, info.broadcast());
+    return info.broadcast();
+}
+
 uint MorseConnection::getContactHandle(const Telegram::Peer &identifier) const
 {
-    return m_contactHandles.key(identifier, 0);
+    return m_contactHandleIds.value(identifier, 0);
 }
 
 uint MorseConnection::getChatHandle(const Telegram::Peer &identifier) const
 {
-    return m_chatHandles.key(identifier, 0);
+    return m_chatHandleIds.value(identifier, 0);
 }
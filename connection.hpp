@@ -28,8 +28,20 @@
 #include <TelegramQt/ConnectionApi>
 #include <TelegramQt/TelegramNamespace>
 
-class MorseDataStorage;
+#include "datastorage.hpp"
+
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QSet>
+
+class QTimer;
+
+class MorseClientBridge;
+class MorseContactInfoCache;
 class MorseInfo;
+class MorseKeepAlive;
+class MorseOutgoingQueue;
+class MorseSyncScheduler;
 class MorseTextChannel;
 
 using MorseTextChannelPtr = Tp::SharedPtr<MorseTextChannel>;
@@ -53,10 +65,12 @@ class InMemoryDataStorage;
 class MorseConnection : public Tp::BaseConnection
 {
     Q_OBJECT
+    friend class MorseConnectionBenchmark;
 public:
     MorseConnection(const QDBusConnection &dbusConnection,
             const QString &cmName, const QString &protocolName,
             const QVariantMap &parameters);
+    ~MorseConnection() override;
 
     static Tp::AvatarSpec avatarDetails();
     static Tp::SimpleStatusSpecMap getSimpleStatusSpecMap();
@@ -85,6 +99,7 @@ public:
 
     QString getContactAlias(uint handle);
     QString getAlias(const Telegram::Peer identifier);
+    void fetchAliases(const QVector<Telegram::Peer> &peers);
 
     Tp::SimplePresence getPresence(uint handle);
     uint setPresence(const QString &status, const QString &message, Tp::DBusError *error);
@@ -95,12 +110,21 @@ public:
     uint ensureChat(const Telegram::Peer &identifier);
 
     Telegram::Client::Client *core() const { return m_client; }
+    MorseClientBridge *bridge() const { return m_bridge; }
+    MorseOutgoingQueue *outgoingQueue() const { return m_outgoingQueue; }
     Telegram::Peer selfPeer() const;
 
     quint64 getSentMessageToken(const Telegram::Peer &dialog, quint32 messageId) const;
     QString getMessageToken(const Telegram::Peer &dialog, quint32 messageId) const;
 
     bool peerIsRoom(const Telegram::Peer peer) const;
+    bool peerIsBroadcast(const Telegram::Peer &peer) const;
+    bool inlineThumbnails() const { return m_inlineThumbnails; }
+
+    // The spool files of the outgoing file transfers; removed once uploaded
+    QString uploadsDirectory() const;
+    void uploadFile(const Telegram::Peer &peer, const QString &filePath, const QString &fileName, const QString &contentType);
+    bool offerFile(const Telegram::Peer &sender, const Telegram::MessageMediaInfo &info, Telegram::Namespace::MessageType type, uint timestamp);
 
 public slots:
     void onSyncMessagesReceived(const Telegram::Peer &peer, const QVector<quint32> &messages);
@@ -127,8 +151,17 @@ private slots:
     void onDialogsReady();
     void onDisconnected();
     void onAvatarRequestFinished(Telegram::Client::FileOperation *fileOperation, const Telegram::Peer &peer);
-    void onMessageSent(const Telegram::Peer &peer, quint64 messageRandomId, quint32 messageId);
+    void onFileUploadFinished(Telegram::Client::FileOperation *fileOperation, const Telegram::Peer &peer);
+    void onMessageSent(const Telegram::Peer &peer, quint64 token, quint32 messageId);
+    void onMessageFailed(const Telegram::Peer &peer, quint64 token);
     void onContactStatusChanged(quint32 userId, Telegram::Namespace::ContactStatus status);
+    void onMessageActionChanged(const Telegram::Peer &peer, quint32 userId, const Telegram::MessageAction &action);
+    void onMessageReadInbox(const Telegram::Peer &peer, quint32 messageId);
+    void onMessageReadOutbox(const Telegram::Peer &peer, quint32 messageId);
+    void onChatDetailsChanged(quint32 chatId, const Tp::UIntList &handles);
+    void updateAliases();
+    void reclaimHandles();
+    void saveRosterSnapshot();
 
     /* Channel.Type.RoomList */
     void onGotRooms();
@@ -139,9 +172,14 @@ protected:
 private:
     uint getContactHandle(const Telegram::Peer &identifier) const;
     uint getChatHandle(const Telegram::Peer &identifier) const;
+    MorseTextChannel *textChannel(const Telegram::Peer &peer) const;
     uint addContacts(const QVector<Telegram::Peer> &identifiers);
+    void setContactList(const QVector<Telegram::Peer> &ids);
 
     void updateContactsPresence(const QVector<Telegram::Peer> &identifiers);
+    void setSelfPeer(const Telegram::Peer &selfIdentifier);
+    bool publishRosterSnapshot();
+    QVector<MorseDataStorage::RosterEntry> getRosterSnapshot();
     void updateSelfContactState(Tp::ConnectionStatus status);
 
     void startMechanismWithData_authCode(const QString &mechanism, const QByteArray &data, Tp::DBusError *error);
@@ -150,11 +188,32 @@ private:
     /* Connection.Interface.Avatars */
     Tp::AvatarTokenMap getKnownAvatarTokens(const Tp::UIntList &contacts, Tp::DBusError *error);
     void requestAvatars(const Tp::UIntList &contacts, Tp::DBusError *error);
+    QHash<Telegram::Peer, QString> getAvatarTokens(const QVector<Telegram::Peer> &peers);
 
     /* Channel.Type.RoomList */
     void roomListStartListing(Tp::DBusError *error);
     void roomListStopListing(Tp::DBusError *error);
 
+    struct RoomSummary
+    {
+        QString title;
+        quint32 participantsCount = 0;
+        bool listed = false; // Rooms migrated to a supergroup are not listed
+    };
+
+    bool getRoomSummary(const Telegram::Peer &peer, RoomSummary *summary);
+    // Marks the handles as used by the clients, so they are not reclaimed
+    void touchHandles(uint handleType, const Tp::UIntList &handles);
+
+    // The invalid peer invalidates all summaries
+    void invalidateRoomSummary(const Telegram::Peer &peer);
+    // Zero userId invalidates all users
+    void invalidateUserInfo(quint32 userId);
+    // Invalidates only the users with changed data
+    void updateUserInfo(const QVector<quint32> &userIds, const QVector<Telegram::UserInfo> &users);
+    // The invalid peer updates all known aliases
+    void scheduleAliasUpdate(const Telegram::Peer &peer);
+
     void loadState();
     void saveState();
 
@@ -169,20 +228,63 @@ private:
     Tp::BaseChannelSASLAuthenticationInterfacePtr saslIface_authCode;
     Tp::BaseChannelSASLAuthenticationInterfacePtr saslIface_password;
     Tp::BaseChannelRoomListTypePtr roomListChannel;
+    QTimer *m_roomListTimer = nullptr;
+    QVector<Telegram::Peer> m_roomListQueue;
+    int m_roomListPosition = 0;
+    QHash<Telegram::Peer, RoomSummary> m_roomSummaries;
+
+    // The aliases ever requested, kept up to date to announce the changes
+    QHash<Telegram::Peer, QString> m_aliases;
+    QSet<Telegram::Peer> m_staleAliases;
+    QTimer *m_aliasUpdateTimer = nullptr;
 
     QString m_wantedPresence;
 
     QVector<quint32> m_contactList;
+    bool m_contactListPublished = false;
+    QTimer *m_rosterSaveTimer = nullptr;
+    QHash<Telegram::Peer, QString> m_snapshotAvatarTokens; // Until the live contact list arrives
+    QHash<uint, Telegram::Namespace::ContactStatus> m_publishedStatuses; // To announce only the changes
     QMap<uint, Telegram::Peer> m_contactHandles;
     QMap<uint, Telegram::Peer> m_chatHandles;
+    QHash<Telegram::Peer, uint> m_contactHandleIds;
+    QHash<Telegram::Peer, uint> m_chatHandleIds;
+    // The handles are never reused, so a reclaimed one can not refer to another peer
+    uint m_lastContactHandle = 0;
+    uint m_lastChatHandle = 0;
+    // The sweep number of the last use of a reclaimable handle
+    QHash<uint, quint32> m_contactHandleUse;
+    QHash<uint, quint32> m_chatHandleUse;
+    quint32 m_handleSweep = 0;
+    QTimer *m_handleSweepTimer = nullptr;
     QHash<QString,Telegram::Peer> m_peerPictureRequests;
 
-    using SentMessageMap = QHash<quint32, quint64>; // messageId to randomMessageId
+    struct FileUpload
+    {
+        QString filePath; // The spool file, removed once uploaded
+        QString contentType;
+        quint64 token = 0; // Of the media message
+    };
+    QHash<Telegram::Client::FileOperation *, FileUpload> m_fileUploads;
+
+    // Routes the peer events to the opened channels; room channels are created only on request
+    QHash<Telegram::Peer, QPointer<MorseTextChannel>> m_textChannels;
+    // The newest message delivered to the channels, so a reconnect resyncs only the dialogs with new ones
+    QHash<Telegram::Peer, quint32> m_deliveredMessageIds;
+    bool m_dialogsSynced = false;
+    QElapsedTimer m_resumeTimer; // Since the connection loss
+
+    using SentMessageMap = QHash<quint32, quint64>; // messageId to the outgoing message token
     QHash<Telegram::Peer, SentMessageMap> m_sentMessageMap;
 
     MorseInfo *m_info = nullptr;
     Telegram::Client::AppInformation *m_appInfo = nullptr;
     Telegram::Client::Client *m_client = nullptr;
+    MorseClientBridge *m_bridge = nullptr;
+    MorseSyncScheduler *m_syncScheduler = nullptr;
+    MorseOutgoingQueue *m_outgoingQueue = nullptr;
+    MorseKeepAlive *m_keepAlive = nullptr;
+    MorseContactInfoCache *m_contactInfoCache = nullptr;
     MorseDataStorage *m_dataStorage = nullptr;
 
     Telegram::Client::AuthOperation *m_signOperation = nullptr;
@@ -197,6 +299,10 @@ private:
     uint m_serverPort = 0;
     uint m_keepAliveInterval;
     bool m_enableAuthentication = false;
+    bool m_inlineThumbnails = false;
+    bool m_broadcastAsContact = false;
+    // The channel id to whether it is a broadcast channel (or a supergroup otherwise)
+    mutable QHash<quint32, bool> m_broadcastChannels;
 };
 
 #endif // MORSE_CONNECTION_HPP
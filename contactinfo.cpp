@@ -0,0 +1,191 @@
+#include "contactinfo.hpp"
+
+#include "clientbridge.hpp"
+
+#include <TelegramQt/DataStorage>
+
+#include <QtConcurrent>
+
+static constexpr int c_parallelRenderThreshold = 1000; // Users, below that the threads startup is not worth it
+
+static QString formatName(const Telegram::UserInfo &userInfo)
+{
+    return (userInfo.firstName() + QLatin1Char(' ') + userInfo.lastName()).simplified();
+}
+
+static QString formatPhone(const Telegram::UserInfo &userInfo)
+{
+    const QString phone = userInfo.phone();
+    if (phone.isEmpty() || phone.startsWith(QLatin1Char('+'))) {
+        return phone;
+    }
+    return QLatin1Char('+') + phone;
+}
+
+static uint fingerprint(const Telegram::UserInfo &userInfo)
+{
+    // The data the rendered fields and the alias are made of
+    return qHash(userInfo.firstName()) ^ (qHash(userInfo.lastName()) * 31)
+            ^ (qHash(userInfo.userName()) * 961) ^ (qHash(userInfo.phone()) * 29791);
+}
+
+MorseContactInfoCache::MorseContactInfoCache(MorseClientBridge *bridge, QObject *parent) :
+    QObject(parent),
+    m_bridge(bridge)
+{
+}
+
+Tp::ContactInfoFieldList MorseContactInfoCache::contactInfo(quint32 userId)
+{
+    const auto it = m_contactInfo.constFind(userId);
+    if (it != m_contactInfo.constEnd()) {
+        return it.value();
+    }
+
+    Telegram::UserInfo userInfo;
+    if (!m_bridge->getUserInfo(&userInfo, userId)) {
+        // Not cached: the user can become known later
+        return Tp::ContactInfoFieldList();
+    }
+
+    const Tp::ContactInfoFieldList contactInfo = renderContactInfo(userInfo);
+    m_contactInfo.insert(userId, contactInfo);
+    m_fingerprints.insert(userId, fingerprint(userInfo));
+    return contactInfo;
+}
+
+QHash<quint32, Tp::ContactInfoFieldList> MorseContactInfoCache::contactInfo(const QVector<quint32> &userIds)
+{
+    QHash<quint32, Tp::ContactInfoFieldList> result;
+    result.reserve(userIds.count());
+    QVector<quint32> missingIds;
+    for (const quint32 userId : userIds) {
+        const auto it = m_contactInfo.constFind(userId);
+        if (it != m_contactInfo.constEnd()) {
+            result.insert(userId, it.value());
+        } else {
+            missingIds.append(userId);
+        }
+    }
+    if (missingIds.isEmpty()) {
+        return result;
+    }
+
+    const QVector<Telegram::UserInfo> users = m_bridge->getUserInfos(&missingIds);
+    QVector<Tp::ContactInfoFieldList> rendered;
+    if (users.count() >= c_parallelRenderThreshold) {
+        rendered = QtConcurrent::blockingMapped<QVector<Tp::ContactInfoFieldList>>(users, &MorseContactInfoCache::renderContactInfo);
+    } else {
+        rendered.reserve(users.count());
+        for (const Telegram::UserInfo &userInfo : users) {
+            rendered.append(renderContactInfo(userInfo));
+        }
+    }
+
+    for (int i = 0; i < missingIds.count(); ++i) {
+        m_contactInfo.insert(missingIds.at(i), rendered.at(i));
+        m_fingerprints.insert(missingIds.at(i), fingerprint(users.at(i)));
+        result.insert(missingIds.at(i), rendered.at(i));
+    }
+    return result;
+}
+
+QVector<quint32> MorseContactInfoCache::update(const QVector<quint32> &userIds, const QVector<Telegram::UserInfo> &users)
+{
+    QVector<quint32> changedIds;
+    for (int i = 0; i < userIds.count(); ++i) {
+        const quint32 userId = userIds.at(i);
+        const uint userFingerprint = fingerprint(users.at(i));
+        auto it = m_fingerprints.find(userId);
+        if (it != m_fingerprints.end()) {
+            if (it.value() == userFingerprint) {
+                continue;
+            }
+            it.value() = userFingerprint;
+        } else {
+            m_fingerprints.insert(userId, userFingerprint);
+        }
+        m_contactInfo.remove(userId);
+        changedIds.append(userId);
+    }
+    return changedIds;
+}
+
+void MorseContactInfoCache::invalidate(quint32 userId)
+{
+    if (userId) {
+        m_contactInfo.remove(userId);
+        m_fingerprints.remove(userId);
+    } else {
+        m_contactInfo.clear();
+        m_fingerprints.clear();
+    }
+}
+
+Tp::ContactInfoFieldList MorseContactInfoCache::renderContactInfo(const Telegram::UserInfo &userInfo)
+{
+    Tp::ContactInfoFieldList contactInfo;
+    contactInfo.reserve(4);
+    if (!userInfo.userName().isEmpty()) {
+        Tp::ContactInfoField contactInfoField;
+        contactInfoField.fieldName = QLatin1String("nickname");
+        contactInfoField.fieldValue.append(userInfo.userName());
+        contactInfo << contactInfoField;
+    }
+    const QString phone = formatPhone(userInfo);
+    if (!phone.isEmpty()) {
+        Tp::ContactInfoField contactInfoField;
+        contactInfoField.fieldName = QLatin1String("tel");
+        contactInfoField.parameters.append(QLatin1String("type=text"));
+        contactInfoField.parameters.append(QLatin1String("type=cell"));
+        contactInfoField.fieldValue.append(phone);
+        contactInfo << contactInfoField;
+    }
+
+    const QString name = formatName(userInfo);
+    if (!name.isEmpty()) {
+        Tp::ContactInfoField contactInfoField;
+        contactInfoField.fieldName = QLatin1String("fn"); // Formatted name
+        contactInfoField.fieldValue.append(name);
+        contactInfo << contactInfoField;
+    }
+    {
+        Tp::ContactInfoField contactInfoField;
+        contactInfoField.fieldName = QLatin1String("n");
+        contactInfoField.fieldValue.append(userInfo.lastName()); // "Surname"
+        contactInfoField.fieldValue.append(userInfo.firstName()); // "Given"
+        contactInfoField.fieldValue.append(QString()); // Additional
+        contactInfoField.fieldValue.append(QString()); // Prefix
+        contactInfoField.fieldValue.append(QString()); // Suffix
+        contactInfo << contactInfoField;
+    }
+
+    return contactInfo;
+}
+
+QString MorseContactInfoCache::renderVCard(const Telegram::UserInfo &userInfo)
+{
+    static const QString lineBreak = QStringLiteral("\r\n");
+    const QString name = formatName(userInfo);
+    if (name.isEmpty()) {
+        return QString();
+    }
+
+    QString result;
+    result.reserve(128);
+    result += QLatin1String("BEGIN:VCARD") + lineBreak;
+    result += QLatin1String("VERSION:4.0") + lineBreak;
+    result += QLatin1String("FN:") + name + lineBreak;
+    const QString phone = formatPhone(userInfo);
+    if (!phone.isEmpty()) {
+        // TEL;VALUE=uri;TYPE=cell:tel:+33-01-23-45-67
+        result += QLatin1String("TEL;PREF:tel") + phone + lineBreak;
+    }
+    // N:Family Names (surnames);Given Names;Additional Names;Honorific Prefixes;Honorific Suffixes
+    // N:Stevenson;John;Philip,Paul;Dr.;Jr.,M.D.,A.C.P.
+    // N:Smith;John;;;
+    result += QLatin1String("N:") + userInfo.lastName() + QLatin1Char(';') + userInfo.firstName() + QLatin1String(";;;") + lineBreak;
+    result += QLatin1String("END:VCARD");
+
+    return result;
+}
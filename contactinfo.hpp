@@ -0,0 +1,55 @@
+#ifndef MORSE_CONTACT_INFO_HPP
+#define MORSE_CONTACT_INFO_HPP
+
+#include <TelegramQt/TelegramNamespace>
+
+#include <TelepathyQt/Types>
+
+#include <QHash>
+#include <QObject>
+
+class MorseClientBridge;
+
+/**
+ * Rendered Connection.Interface.ContactInfo fields of the known users.
+ *
+ * The fields are rendered from the data storage on the first request and kept
+ * until the user is invalidated, so GetContactInfo(), RequestContactInfo() and
+ * the contact attributes do not copy and reformat UserInfo for every handle on
+ * every call. A fingerprint of the user data is kept beside each entry, so
+ * update() drops only the entries of the actually changed users. A batch of
+ * missing users is fetched with a single client call and a large one is
+ * rendered by the global thread pool. The cache is supposed to be used from
+ * the connection thread only.
+ */
+class MorseContactInfoCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MorseContactInfoCache(MorseClientBridge *bridge, QObject *parent = nullptr);
+
+    // Returns an empty list for an unknown user
+    Tp::ContactInfoFieldList contactInfo(quint32 userId);
+    // Renders all missing users in one pass; the unknown users are omitted
+    QHash<quint32, Tp::ContactInfoFieldList> contactInfo(const QVector<quint32> &userIds);
+
+    // Drops the users whose data has changed (or was not known) and returns their ids;
+    // userIds and users are parallel, as returned by MorseClientBridge::getUserInfos()
+    QVector<quint32> update(const QVector<quint32> &userIds, const QVector<Telegram::UserInfo> &users);
+
+    // Zero userId invalidates all users
+    void invalidate(quint32 userId);
+
+    int count() const { return m_contactInfo.count(); }
+
+    static Tp::ContactInfoFieldList renderContactInfo(const Telegram::UserInfo &userInfo);
+    // Returns an empty string for a user without a name
+    static QString renderVCard(const Telegram::UserInfo &userInfo);
+
+protected:
+    MorseClientBridge *m_bridge = nullptr;
+    QHash<quint32, Tp::ContactInfoFieldList> m_contactInfo;
+    QHash<quint32, uint> m_fingerprints;
+};
+
+#endif // MORSE_CONTACT_INFO_HPP
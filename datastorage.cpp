@@ -1,14 +1,18 @@
 #include "datastorage.hpp"
+#include "eventloopmonitor.hpp"
 #include "info.hpp"
 
 #include <TelegramQt/TelegramNamespace>
 
+#include <QDataStream>
 #include <QDir>
 #include <QFile>
 #include <QLoggingCategory>
+#include <QSaveFile>
 
 static const QString c_telegramStateFile = QLatin1String("telegram-state.bin");
 static const QString c_morseStateFile = QLatin1String("morse-state.bin");
+static constexpr quint32 c_morseStateFormatVersion = 1;
 
 MorseDataStorage::MorseDataStorage(QObject *parent) :
     Telegram::Client::InMemoryDataStorage(parent)
@@ -20,8 +24,15 @@ void MorseDataStorage::setInfo(MorseInfo *info)
     m_info = info;
 }
 
+void MorseDataStorage::setRoster(quint32 selfUserId, const QVector<RosterEntry> &roster)
+{
+    m_rosterSelfUserId = selfUserId;
+    m_roster = roster;
+}
+
 bool MorseDataStorage::saveData() const
 {
+    MORSE_MONITOR_SCOPE();
     const QByteArray data = saveState();
 
     QDir dir;
@@ -41,11 +52,14 @@ bool MorseDataStorage::saveData() const
     }
     qDebug() << Q_FUNC_INFO << "State saved to file" << stateFile.fileName();
 
+    saveRoster();
+
     return true;
 }
 
 bool MorseDataStorage::loadData()
 {
+    MORSE_MONITOR_SCOPE();
     // TODO: Load sent message ids map
 
     QFile stateFile(m_info->accountDataDirectory() + QLatin1Char('/') + c_telegramStateFile);
@@ -59,6 +73,75 @@ bool MorseDataStorage::loadData()
     qDebug() << Q_FUNC_INFO << m_info->accountIdentifier() << "(" << data.size() << "bytes)";
 
     loadState(data);
+    loadRoster();
+
+    return true;
+}
+
+bool MorseDataStorage::saveRoster() const
+{
+    QDir().mkpath(m_info->accountDataDirectory());
+    QSaveFile rosterFile(m_info->accountDataDirectory() + QLatin1Char('/') + c_morseStateFile);
+    if (!rosterFile.open(QIODevice::WriteOnly)) {
+        qWarning() << Q_FUNC_INFO << "Unable to open state file" << rosterFile.fileName();
+        return false;
+    }
+
+    QDataStream stream(&rosterFile);
+    stream << c_morseStateFormatVersion;
+    stream << m_rosterSelfUserId;
+    stream << static_cast<quint32>(m_roster.count());
+    for (const RosterEntry &entry : m_roster) {
+        stream << entry.peer.toString();
+        stream << entry.alias;
+        stream << entry.avatarToken;
+    }
+
+    if (!rosterFile.commit()) {
+        qWarning() << Q_FUNC_INFO << "Unable to save the roster to file" << rosterFile.fileName();
+        return false;
+    }
+    return true;
+}
+
+bool MorseDataStorage::loadRoster()
+{
+    QFile rosterFile(m_info->accountDataDirectory() + QLatin1Char('/') + c_morseStateFile);
+    if (!rosterFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&rosterFile);
+    quint32 version = 0;
+    stream >> version;
+    if (version != c_morseStateFormatVersion) {
+        qWarning() << Q_FUNC_INFO << "Unsupported state format version" << version;
+        return false;
+    }
+
+    quint32 selfUserId = 0;
+    quint32 count = 0;
+    stream >> selfUserId;
+    stream >> count;
+
+    QVector<RosterEntry> roster;
+    for (quint32 i = 0; (i < count) && (stream.status() == QDataStream::Ok); ++i) {
+        RosterEntry entry;
+        QString peer;
+        stream >> peer;
+        stream >> entry.alias;
+        stream >> entry.avatarToken;
+        entry.peer = Telegram::Peer::fromString(peer);
+        if (entry.peer.isValid()) {
+            roster.append(entry);
+        }
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << Q_FUNC_INFO << "Unable to read state file" << rosterFile.fileName();
+        return false;
+    }
 
+    setRoster(selfUserId, roster);
     return true;
 }
@@ -3,22 +3,41 @@
 
 #include <TelegramQt/DataStorage>
 
+#include <QVector>
+
 class MorseInfo;
 
 class MorseDataStorage : public Telegram::Client::InMemoryDataStorage
 {
     Q_OBJECT
 public:
+    // The last published contact list, shown until the live one arrives
+    struct RosterEntry
+    {
+        Telegram::Peer peer;
+        QString alias;
+        QString avatarToken;
+    };
+
     explicit MorseDataStorage(QObject *parent = nullptr);
 
     void setInfo(MorseInfo *info);
 
+    quint32 rosterSelfUserId() const { return m_rosterSelfUserId; }
+    QVector<RosterEntry> roster() const { return m_roster; }
+    void setRoster(quint32 selfUserId, const QVector<RosterEntry> &roster);
+
 public slots:
     bool saveData() const;
     bool loadData();
+    bool saveRoster() const;
 
 protected:
+    bool loadRoster();
+
     MorseInfo *m_info = nullptr;
+    quint32 m_rosterSelfUserId = 0;
+    QVector<RosterEntry> m_roster;
 
 };
 
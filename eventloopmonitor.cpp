@@ -0,0 +1,183 @@
+#include "eventloopmonitor.hpp"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+
+static const int c_reportedOffendersCount = 5;
+static const QByteArray c_unmarkedScopeName = QByteArrayLiteral("<unmarked>");
+
+static MorseEventLoopMonitor *s_instance = nullptr;
+
+MorseEventLoopMonitor::Scope::Scope(const char *name) :
+    m_name(name)
+{
+    m_timer.start();
+}
+
+MorseEventLoopMonitor::Scope::~Scope()
+{
+    if (s_instance && s_instance->isActive()) {
+        s_instance->recordScope(m_name, m_timer.elapsed());
+    }
+}
+
+MorseEventLoopMonitor::MorseEventLoopMonitor(QObject *parent) :
+    QObject(parent)
+{
+}
+
+MorseEventLoopMonitor *MorseEventLoopMonitor::instance()
+{
+    if (!s_instance) {
+        s_instance = new MorseEventLoopMonitor(QCoreApplication::instance());
+    }
+    return s_instance;
+}
+
+void MorseEventLoopMonitor::setProbeInterval(int msec)
+{
+    m_probeInterval = msec;
+    if (m_probeTimer) {
+        m_probeTimer->setInterval(m_probeInterval);
+    }
+}
+
+void MorseEventLoopMonitor::setLagThreshold(int msec)
+{
+    m_lagThreshold = msec;
+}
+
+void MorseEventLoopMonitor::setReportInterval(int msec)
+{
+    m_reportInterval = msec;
+    if (m_reportTimer) {
+        m_reportTimer->setInterval(m_reportInterval);
+    }
+}
+
+QVector<MorseEventLoopMonitor::Offender> MorseEventLoopMonitor::worstOffenders(int count) const
+{
+    QMutexLocker locker(&m_offendersMutex);
+    QVector<Offender> result;
+    result.reserve(m_offenders.count());
+    for (const Offender &offender : m_offenders) {
+        result.append(offender);
+    }
+    locker.unlock();
+
+    std::sort(result.begin(), result.end(), [](const Offender &left, const Offender &right) {
+        return left.maxDuration > right.maxDuration;
+    });
+    if (result.count() > count) {
+        result.resize(count);
+    }
+    return result;
+}
+
+void MorseEventLoopMonitor::start()
+{
+    if (!m_probeTimer) {
+        m_probeTimer = new QTimer(this);
+        m_probeTimer->setTimerType(Qt::PreciseTimer);
+        connect(m_probeTimer, &QTimer::timeout, this, &MorseEventLoopMonitor::onProbeTimeout);
+
+        m_reportTimer = new QTimer(this);
+        connect(m_reportTimer, &QTimer::timeout, this, &MorseEventLoopMonitor::report);
+    }
+    m_probeTimer->setInterval(m_probeInterval);
+    m_reportTimer->setInterval(m_reportInterval);
+
+    m_sinceLastProbe.start();
+    m_probeTimer->start();
+    m_reportTimer->start();
+    m_active.store(1);
+}
+
+void MorseEventLoopMonitor::stop()
+{
+    if (!m_probeTimer) {
+        return;
+    }
+    m_active.store(0);
+    m_probeTimer->stop();
+    m_reportTimer->stop();
+}
+
+void MorseEventLoopMonitor::report()
+{
+    {
+        QMutexLocker locker(&m_offendersMutex);
+        if (!m_hasNewOffenders) {
+            return;
+        }
+        m_hasNewOffenders = false;
+    }
+
+    qInfo().nospace() << "Event loop monitor: " << m_stallsCount << " stalls over "
+                      << m_lagThreshold << " ms, max lag " << m_maxLag << " ms";
+
+    for (const Offender &offender : worstOffenders(c_reportedOffendersCount)) {
+        qInfo().nospace() << "  " << offender.name.constData()
+                          << ": " << offender.count << " times"
+                          << ", max " << offender.maxDuration << " ms"
+                          << ", total " << offender.totalDuration << " ms";
+    }
+}
+
+void MorseEventLoopMonitor::onProbeTimeout()
+{
+    const qint64 lag = m_sinceLastProbe.restart() - m_probeInterval;
+    const QByteArray slowScope = m_lastSlowScope;
+    m_lastSlowScope.clear();
+    m_lastSlowScopeDuration = 0;
+
+    if (lag < m_lagThreshold) {
+        return;
+    }
+
+    ++m_stallsCount;
+    m_maxLag = qMax(m_maxLag, lag);
+
+    if (slowScope.isEmpty()) {
+        // Nothing marked took that long, so the time went to a handler without a scope
+        recordOffender(c_unmarkedScopeName, lag);
+        qWarning() << "Event loop stalled for" << lag << "ms in an unmarked handler";
+    } else {
+        qWarning() << "Event loop stalled for" << lag << "ms in" << slowScope.constData();
+    }
+}
+
+void MorseEventLoopMonitor::recordScope(const char *name, qint64 duration)
+{
+    if (duration < m_lagThreshold) {
+        return;
+    }
+
+    // Scope names are Q_FUNC_INFO literals, so there is no need to copy them
+    const QByteArray scopeName = QByteArray::fromRawData(name, qstrlen(name));
+    recordOffender(scopeName, duration);
+
+    if (QThread::currentThread() != thread()) {
+        return;
+    }
+    if (duration > m_lastSlowScopeDuration) {
+        m_lastSlowScope = scopeName;
+        m_lastSlowScopeDuration = duration;
+    }
+}
+
+void MorseEventLoopMonitor::recordOffender(const QByteArray &name, qint64 duration)
+{
+    QMutexLocker locker(&m_offendersMutex);
+    Offender &offender = m_offenders[name];
+    offender.name = name;
+    ++offender.count;
+    offender.maxDuration = qMax(offender.maxDuration, duration);
+    offender.totalDuration += duration;
+    m_hasNewOffenders = true;
+}
@@ -0,0 +1,93 @@
+#ifndef MORSE_EVENT_LOOP_MONITOR_HPP
+#define MORSE_EVENT_LOOP_MONITOR_HPP
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+class QTimer;
+
+class MorseEventLoopMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name);
+        ~Scope();
+
+    private:
+        const char *m_name;
+        QElapsedTimer m_timer;
+    };
+
+    struct Offender
+    {
+        QByteArray name;
+        quint32 count = 0;
+        qint64 maxDuration = 0;
+        qint64 totalDuration = 0;
+    };
+
+    static MorseEventLoopMonitor *instance();
+
+    int probeInterval() const { return m_probeInterval; }
+    void setProbeInterval(int msec);
+
+    int lagThreshold() const { return m_lagThreshold; }
+    void setLagThreshold(int msec);
+
+    int reportInterval() const { return m_reportInterval; }
+    void setReportInterval(int msec);
+
+    // Thread-safe: scopes of the client thread check it too
+    bool isActive() const { return m_active.load(); }
+
+    qint64 maxLag() const { return m_maxLag; }
+    quint32 stallsCount() const { return m_stallsCount; }
+    QVector<Offender> worstOffenders(int count) const;
+
+public slots:
+    void start();
+    void stop();
+    void report();
+
+protected slots:
+    void onProbeTimeout();
+
+protected:
+    explicit MorseEventLoopMonitor(QObject *parent = nullptr);
+
+    void recordScope(const char *name, qint64 duration);
+    void recordOffender(const QByteArray &name, qint64 duration);
+
+    QTimer *m_probeTimer = nullptr;
+    QTimer *m_reportTimer = nullptr;
+    QAtomicInt m_active;
+    QElapsedTimer m_sinceLastProbe;
+
+    int m_probeInterval = 100;
+    int m_lagThreshold = 200;
+    int m_reportInterval = 5 * 60 * 1000;
+
+    qint64 m_maxLag = 0;
+    quint32 m_stallsCount = 0;
+    bool m_hasNewOffenders = false;
+
+    // The longest over-threshold scope seen since the last probe; used to attribute the lag
+    QByteArray m_lastSlowScope;
+    qint64 m_lastSlowScopeDuration = 0;
+
+    mutable QMutex m_offendersMutex;
+    QHash<QByteArray, Offender> m_offenders;
+
+    friend class Scope;
+};
+
+#define MORSE_MONITOR_SCOPE() MorseEventLoopMonitor::Scope morseMonitorScope(Q_FUNC_INFO)
+
+#endif // MORSE_EVENT_LOOP_MONITOR_HPP
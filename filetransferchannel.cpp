@@ -0,0 +1,163 @@
+#include "filetransferchannel.hpp"
+#include "clientbridge.hpp"
+#include "connection.hpp"
+#include "streamdevice.hpp"
+
+#include <TelegramQt/Client>
+#include <TelegramQt/FileOperation>
+#include <TelegramQt/FilesApi>
+
+#include <TelepathyQt/Constants>
+
+#include <QDebug>
+#include <QDir>
+#include <QTemporaryFile>
+#include <QTimer>
+
+MorseFileTransferChannel::MorseFileTransferChannel(MorseConnection *morseConnection, Tp::BaseChannel *baseChannel,
+                                                   const QVariantMap &request, const Telegram::FileInfo &remoteFile)
+    : Tp::BaseChannelFileTransferType(request),
+      m_connection(morseConnection),
+      m_bridge(morseConnection->bridge()),
+      m_targetPeer(Telegram::Peer::fromString(baseChannel->targetID())),
+      m_remoteFile(remoteFile)
+{
+    connect(this, &Tp::BaseChannelFileTransferType::stateChanged,
+            this, &MorseFileTransferChannel::onStateChanged);
+
+    if (!m_remoteFile.isValid()) {
+        const QString spoolDirectory = m_connection->uploadsDirectory();
+        QDir().mkpath(spoolDirectory);
+        m_spool = new QTemporaryFile(spoolDirectory + QLatin1String("/upload-XXXXXX"), this);
+        // Accept once the channel is announced
+        QTimer::singleShot(0, this, &MorseFileTransferChannel::acceptFile);
+    }
+}
+
+MorseFileTransferChannelPtr MorseFileTransferChannel::create(MorseConnection *morseConnection, Tp::BaseChannel *baseChannel,
+                                                             const QVariantMap &request)
+{
+    return MorseFileTransferChannelPtr(new MorseFileTransferChannel(morseConnection, baseChannel, request, Telegram::FileInfo()));
+}
+
+MorseFileTransferChannelPtr MorseFileTransferChannel::createIncoming(MorseConnection *morseConnection, Tp::BaseChannel *baseChannel,
+                                                                     const QVariantMap &request, const Telegram::FileInfo &remoteFile)
+{
+    return MorseFileTransferChannelPtr(new MorseFileTransferChannel(morseConnection, baseChannel, request, remoteFile));
+}
+
+MorseFileTransferChannel::~MorseFileTransferChannel()
+{
+    cancelDownload();
+}
+
+void MorseFileTransferChannel::acceptFile()
+{
+    if (!m_spool->open()) {
+        qWarning() << Q_FUNC_INFO << "Unable to open spool file" << m_spool->fileName();
+        setState(Tp::FileTransferStateCancelled, Tp::FileTransferStateChangeReasonLocalError);
+        return;
+    }
+    qDebug() << Q_FUNC_INFO << filename() << size() << "bytes to" << m_targetPeer.toString();
+    remoteAcceptFile(m_spool, /* offset */ 0);
+}
+
+void MorseFileTransferChannel::onStateChanged(uint state, uint reason)
+{
+    Q_UNUSED(reason)
+
+    switch (state) {
+    case Tp::FileTransferStateAccepted:
+        if (m_remoteFile.isValid()) {
+            startDownload();
+        }
+        break;
+    case Tp::FileTransferStateCompleted:
+        if (!m_remoteFile.isValid()) {
+            startUpload();
+        }
+        break;
+    case Tp::FileTransferStateCancelled:
+        cancelDownload();
+        break;
+    default:
+        break;
+    }
+}
+
+void MorseFileTransferChannel::onDownloadFinished(Telegram::Client::FileOperation *fileOperation)
+{
+    if (fileOperation != m_downloadOperation) {
+        // Cancelled, the operation is deleted already
+        return;
+    }
+    m_downloadOperation = nullptr;
+    if (fileOperation->isFailed()) {
+        qWarning() << Q_FUNC_INFO << "Download failed:" << fileOperation->errorDetails();
+        setState(Tp::FileTransferStateCancelled, Tp::FileTransferStateChangeReasonRemoteError);
+    }
+    m_bridge->post([fileOperation]() {
+        fileOperation->deleteLater();
+    });
+}
+
+void MorseFileTransferChannel::startUpload()
+{
+    if (!m_spool->flush()) {
+        qWarning() << Q_FUNC_INFO << "Unable to write spool file" << m_spool->fileName();
+        return;
+    }
+
+    // The upload continues after the channel is closed, so the connection takes the spool file over
+    m_spool->setAutoRemove(false);
+    const QString spoolFileName = m_spool->fileName();
+    m_spool->close();
+
+    m_connection->uploadFile(m_targetPeer, spoolFileName, filename(), contentType());
+}
+
+void MorseFileTransferChannel::startDownload()
+{
+    if (m_download) {
+        return;
+    }
+    qDebug() << Q_FUNC_INFO << filename() << size() << "bytes from" << m_targetPeer.toString();
+
+    // Not owned by the channel: the download keeps writing to it until finished
+    m_download = new MorseStreamDevice();
+    m_download->open(QIODevice::ReadWrite|QIODevice::Unbuffered);
+    remoteProvideFile(m_download);
+
+    Telegram::Client::Client *client = m_connection->core();
+    MorseStreamDevice *device = m_download;
+    // Connected in the client thread to not miss the end of a small file
+    m_bridge->run([this, client, device]() {
+        m_downloadOperation = client->filesApi()->downloadFile(&m_remoteFile, device);
+        connect(m_downloadOperation, &Telegram::PendingOperation::finished,
+                device, &MorseStreamDevice::finish);
+        m_downloadOperation->connectToFinished(this, &MorseFileTransferChannel::onDownloadFinished, m_downloadOperation);
+    });
+}
+
+void MorseFileTransferChannel::cancelDownload()
+{
+    if (!m_download) {
+        return;
+    }
+    MorseStreamDevice *device = m_download;
+    m_download = nullptr;
+    // Nobody reads the rest anymore
+    device->release();
+    if (!m_downloadOperation) {
+        return;
+    }
+
+    // The client has no call to abort a download, so delete the operation to stop it.
+    // It is not going to finish anymore, so finish the device for it.
+    Telegram::Client::FileOperation *fileOperation = m_downloadOperation;
+    m_downloadOperation = nullptr;
+    m_bridge->post([fileOperation, device]() {
+        delete fileOperation;
+        QMetaObject::invokeMethod(device, "finish", Qt::QueuedConnection);
+    });
+}
@@ -0,0 +1,73 @@
+#ifndef MORSE_FILE_TRANSFER_CHANNEL_HPP
+#define MORSE_FILE_TRANSFER_CHANNEL_HPP
+
+#include <TelegramQt/TelegramNamespace>
+
+#include <TelepathyQt/BaseChannel>
+
+class QTemporaryFile;
+
+class MorseClientBridge;
+class MorseConnection;
+class MorseFileTransferChannel;
+class MorseStreamDevice;
+
+namespace Telegram {
+
+namespace Client {
+
+class FileOperation;
+
+} // Client namespace
+
+} // Telegram namespace
+
+typedef Tp::SharedPtr<MorseFileTransferChannel> MorseFileTransferChannelPtr;
+
+/**
+ * File transfer from or to a Telegram peer.
+ *
+ * Outgoing: Telegram has no remote side to accept a file, so the transfer
+ * is accepted as soon as the channel is created. The client socket data is
+ * spooled to a file in MorseConnection::uploadsDirectory() as it arrives,
+ * so the memory usage does not depend on the file size. Once the client has
+ * sent the whole file, the spool is handed over to MorseConnection::uploadFile(),
+ * which outlives the channel.
+ *
+ * Incoming: the channel offers a media file of a received message and starts
+ * to download it only when the client accepts the transfer. The downloaded
+ * data goes to the client socket as it arrives.
+ */
+class MorseFileTransferChannel : public Tp::BaseChannelFileTransferType
+{
+    Q_OBJECT
+public:
+    static MorseFileTransferChannelPtr create(MorseConnection *morseConnection, Tp::BaseChannel *baseChannel,
+                                              const QVariantMap &request);
+    static MorseFileTransferChannelPtr createIncoming(MorseConnection *morseConnection, Tp::BaseChannel *baseChannel,
+                                                      const QVariantMap &request, const Telegram::FileInfo &remoteFile);
+    ~MorseFileTransferChannel() override;
+
+protected slots:
+    void acceptFile();
+    void onStateChanged(uint state, uint reason);
+    void onDownloadFinished(Telegram::Client::FileOperation *fileOperation);
+
+private:
+    MorseFileTransferChannel(MorseConnection *morseConnection, Tp::BaseChannel *baseChannel,
+                             const QVariantMap &request, const Telegram::FileInfo &remoteFile);
+
+    void startUpload();
+    void startDownload();
+    void cancelDownload();
+
+    MorseConnection *m_connection;
+    MorseClientBridge *m_bridge = nullptr;
+    Telegram::Peer m_targetPeer;
+    Telegram::FileInfo m_remoteFile; // Valid for the incoming transfers only
+    QTemporaryFile *m_spool = nullptr;
+    MorseStreamDevice *m_download = nullptr;
+    Telegram::Client::FileOperation *m_downloadOperation = nullptr; // Until finished, lives in the client thread
+};
+
+#endif // MORSE_FILE_TRANSFER_CHANNEL_HPP
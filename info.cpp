@@ -1,7 +1,5 @@
 #include "info.hpp"
 
-#include <QStandardPaths>
-
 static const QString c_accountsDirectory = QLatin1String("telepathy/morse");
 static const QString c_accountFile = QLatin1String("account.bin");
 
@@ -26,14 +24,7 @@ QString MorseInfo::appHash()
 
 QString MorseInfo::accountDataDirectory() const
 {
-    if (m_accountIdentifier.isEmpty()) {
-        return QString();
-    }
-    const QString serverIdentifier = m_serverIdentifier.isEmpty() ? QStringLiteral("official") : m_serverIdentifier;
-    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
-            + QLatin1Char('/') + c_accountsDirectory
-            + QLatin1Char('/') + serverIdentifier
-            + QLatin1Char('/') + m_accountIdentifier;
+    return accountDirectory(QStandardPaths::GenericDataLocation);
 }
 
 QString MorseInfo::accountDataFilePath() const
@@ -45,6 +36,23 @@ QString MorseInfo::accountDataFilePath() const
     return directory + QLatin1Char('/') + c_accountFile;
 }
 
+QString MorseInfo::accountCacheDirectory() const
+{
+    return accountDirectory(QStandardPaths::GenericCacheLocation);
+}
+
+QString MorseInfo::accountDirectory(QStandardPaths::StandardLocation location) const
+{
+    if (m_accountIdentifier.isEmpty()) {
+        return QString();
+    }
+    const QString serverIdentifier = m_serverIdentifier.isEmpty() ? QStringLiteral("official") : m_serverIdentifier;
+    return QStandardPaths::writableLocation(location)
+            + QLatin1Char('/') + c_accountsDirectory
+            + QLatin1Char('/') + serverIdentifier
+            + QLatin1Char('/') + m_accountIdentifier;
+}
+
 QString MorseInfo::accountIdentifier() const
 {
     return m_accountIdentifier;
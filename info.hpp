@@ -2,6 +2,7 @@
 #define MORSE_INFO_HPP
 
 #include <QObject>
+#include <QStandardPaths>
 
 class MorseInfo : public QObject
 {
@@ -14,6 +15,7 @@ class MorseInfo : public QObject
 
     Q_PROPERTY(QString accountDataDirectory READ accountDataDirectory NOTIFY accountDataDirectoryChanged)
     Q_PROPERTY(QString accountDataFilePath READ accountDataFilePath NOTIFY accountDataDirectoryChanged)
+    Q_PROPERTY(QString accountCacheDirectory READ accountCacheDirectory NOTIFY accountDataDirectoryChanged)
     Q_PROPERTY(QString accountIdentifier READ accountIdentifier WRITE setAccountIdentifier NOTIFY accountIdentifierChanged)
     Q_PROPERTY(QString serverIdentifier READ serverIdentifier WRITE setServerIdentifier NOTIFY serverIdentifierChanged)
 public:
@@ -26,6 +28,7 @@ public:
 
     QString accountDataDirectory() const;
     QString accountDataFilePath() const;
+    QString accountCacheDirectory() const;
     QString accountIdentifier() const;
     QString serverIdentifier() const;
 
@@ -40,6 +43,8 @@ signals:
     void serverIdentifierChanged();
 
 protected:
+    QString accountDirectory(QStandardPaths::StandardLocation location) const;
+
     QString m_accountIdentifier;
     QString m_serverIdentifier;
 };
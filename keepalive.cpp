@@ -0,0 +1,117 @@
+#include "keepalive.hpp"
+
+#include "clientbridge.hpp"
+#include "metrics.hpp"
+
+#include <TelegramQt/Client>
+#include <TelegramQt/ClientSettings>
+
+#include <QDebug>
+#include <QNetworkConfigurationManager>
+#include <QTimer>
+
+static const QByteArray c_intervalDuration = QByteArrayLiteral("keepalive.interval");
+static const QByteArray c_missedPongsGauge = QByteArrayLiteral("keepalive.missed");
+
+MorseKeepAlive::MorseKeepAlive(MorseClientBridge *bridge, QObject *parent) :
+    QObject(parent),
+    m_bridge(bridge),
+    m_networkManager(new QNetworkConfigurationManager(this)),
+    m_stableTimer(new QTimer(this))
+{
+    connect(m_networkManager, &QNetworkConfigurationManager::onlineStateChanged,
+            this, &MorseKeepAlive::onOnlineStateChanged);
+    m_stableTimer->setSingleShot(true);
+    connect(m_stableTimer, &QTimer::timeout, this, &MorseKeepAlive::onStablePeriod);
+}
+
+void MorseKeepAlive::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    if (!m_enabled) {
+        m_stableTimer->stop();
+    }
+}
+
+void MorseKeepAlive::setInterval(int interval)
+{
+    // The configured interval is the longest one and is not adapted below the configured minimum
+    m_minInterval = qMin(m_minInterval, interval);
+    m_maxInterval = interval;
+    m_interval = interval;
+}
+
+void MorseKeepAlive::setMinInterval(int interval)
+{
+    m_minInterval = qMax(1000, interval);
+    m_maxInterval = qMax(m_maxInterval, m_minInterval);
+    m_interval = qMax(m_interval, m_minInterval);
+}
+
+void MorseKeepAlive::setStablePeriods(int periods)
+{
+    m_stablePeriods = qMax(1, periods);
+}
+
+void MorseKeepAlive::onConnectionReady()
+{
+    if (!m_enabled || m_ready) {
+        return;
+    }
+    m_ready = true;
+    m_networkChanged = false;
+    m_activeInterval = m_interval;
+    MorseMetrics::instance()->recordDuration(c_intervalDuration, m_activeInterval);
+    if (m_activeInterval < m_maxInterval) {
+        m_stableTimer->start(m_stablePeriods * m_activeInterval);
+    }
+}
+
+void MorseKeepAlive::onConnectionLost(bool requested)
+{
+    if (!m_ready) {
+        return;
+    }
+    m_ready = false;
+    m_stableTimer->stop();
+    if (requested) {
+        return;
+    }
+    // The socket of a gone or switched network is dropped regardless of the pings
+    if (m_networkChanged || !m_networkManager->isOnline()) {
+        qDebug() << Q_FUNC_INFO << "Connection lost with the network, keep the interval";
+        return;
+    }
+
+    // The client drops the connection if the server does not answer the pings
+    ++m_missedPongsCount;
+    MorseMetrics::instance()->addToGauge(c_missedPongsGauge, 1);
+    setNextInterval(qMax(m_minInterval, m_activeInterval / 2));
+    qDebug() << Q_FUNC_INFO << "Missed pongs:" << m_missedPongsCount << "interval:" << m_interval << "ms";
+}
+
+void MorseKeepAlive::onOnlineStateChanged(bool online)
+{
+    Q_UNUSED(online)
+    m_networkChanged = true;
+}
+
+void MorseKeepAlive::onStablePeriod()
+{
+    // Once per connection: a longer interval can be proven only by the next one
+    setNextInterval(qMin(m_maxInterval, m_activeInterval * 3 / 2));
+}
+
+void MorseKeepAlive::setNextInterval(int interval)
+{
+    if (interval == m_interval) {
+        return;
+    }
+    m_interval = interval;
+    qDebug() << Q_FUNC_INFO << "Ping interval of the next connection:" << m_interval << "ms";
+
+    Telegram::Client::Client *client = m_bridge->client();
+    m_bridge->post([client, interval]() {
+        client->settings()->setPingInterval(interval);
+    });
+}
@@ -0,0 +1,70 @@
+#ifndef MORSE_KEEP_ALIVE_HPP
+#define MORSE_KEEP_ALIVE_HPP
+
+#include <QObject>
+
+class QNetworkConfigurationManager;
+class QTimer;
+
+class MorseClientBridge;
+
+/**
+ * Adapts the ping interval of the Telegram client to the network.
+ *
+ * A connection lost without a request while the network stayed up is taken
+ * as a missed pong (e.g. an idle timeout of a NAT on the way to the server)
+ * and the interval is halved, down to minInterval(). A connection lost on a
+ * network change or outage keeps the interval. After a connection stays
+ * ready for stablePeriods() intervals, the interval grows back by half, up
+ * to the configured one.
+ *
+ * The client applies the ping interval when it establishes a connection,
+ * so a new interval is in effect from the next (re)connection.
+ */
+class MorseKeepAlive : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MorseKeepAlive(MorseClientBridge *bridge, QObject *parent = nullptr);
+
+    bool isEnabled() const { return m_enabled; }
+    void setEnabled(bool enabled);
+
+    // The intervals are in ms; zero if the keepalive is disabled
+    int interval() const { return m_enabled ? m_interval : 0; }
+    void setInterval(int interval);
+
+    int minInterval() const { return m_minInterval; }
+    void setMinInterval(int interval);
+
+    int stablePeriods() const { return m_stablePeriods; }
+    void setStablePeriods(int periods);
+
+    quint32 missedPongsCount() const { return m_missedPongsCount; }
+
+public slots:
+    void onConnectionReady();
+    void onConnectionLost(bool requested);
+
+protected slots:
+    void onOnlineStateChanged(bool online);
+    void onStablePeriod();
+
+protected:
+    void setNextInterval(int interval);
+
+    MorseClientBridge *m_bridge = nullptr;
+    QNetworkConfigurationManager *m_networkManager = nullptr;
+    QTimer *m_stableTimer = nullptr;
+    bool m_enabled = true;
+    bool m_ready = false;
+    bool m_networkChanged = false; // Since the connection became ready
+    int m_interval = 15000; // For the next connection
+    int m_activeInterval = 0; // Of the current connection
+    int m_maxInterval = 15000; // The configured one
+    int m_minInterval = 5000;
+    int m_stablePeriods = 4;
+    quint32 m_missedPongsCount = 0;
+};
+
+#endif // MORSE_KEEP_ALIVE_HPP
@@ -25,7 +25,9 @@
 
 #include <TelegramQt/TelegramNamespace>
 
+#include "eventloopmonitor.hpp"
 #include "info.hpp"
+#include "metrics.hpp"
 #include "protocol.hpp"
 
 #ifdef ENABLE_DEBUG_IFACE
@@ -48,6 +50,8 @@ int main(int argc, char *argv[])
 #ifdef ENABLE_DEBUG_IFACE
     enableDebugInterface();
 #endif
+    MorseEventLoopMonitor::instance()->start();
+    MorseMetrics::instance()->start();
 
     Tp::BaseProtocolPtr proto = Tp::BaseProtocol::create<MorseProtocol>(QLatin1String("telegram"));
     Tp::BaseConnectionManagerPtr cm = Tp::BaseConnectionManager::create(QLatin1String("morse"));
@@ -0,0 +1,107 @@
+#include "metrics.hpp"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QTimer>
+
+#include <algorithm>
+
+static MorseMetrics *s_instance = nullptr;
+
+MorseMetrics::MorseMetrics(QObject *parent) :
+    QObject(parent)
+{
+}
+
+MorseMetrics *MorseMetrics::instance()
+{
+    if (!s_instance) {
+        s_instance = new MorseMetrics(QCoreApplication::instance());
+    }
+    return s_instance;
+}
+
+void MorseMetrics::setReportInterval(int msec)
+{
+    m_reportInterval = msec;
+    if (m_reportTimer) {
+        m_reportTimer->setInterval(m_reportInterval);
+    }
+}
+
+void MorseMetrics::addToGauge(const QByteArray &name, qint64 delta)
+{
+    if (!delta) {
+        return;
+    }
+    QMutexLocker locker(&m_mutex);
+    m_gauges[name] += delta;
+    m_hasUpdates = true;
+}
+
+qint64 MorseMetrics::gauge(const QByteArray &name) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_gauges.value(name);
+}
+
+void MorseMetrics::recordDuration(const QByteArray &name, qint64 msec)
+{
+    QMutexLocker locker(&m_mutex);
+    Duration &duration = m_durations[name];
+    ++duration.count;
+    duration.maxDuration = qMax(duration.maxDuration, msec);
+    duration.totalDuration += msec;
+    m_hasUpdates = true;
+}
+
+MorseMetrics::Duration MorseMetrics::duration(const QByteArray &name) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_durations.value(name);
+}
+
+void MorseMetrics::start()
+{
+    if (!m_reportTimer) {
+        m_reportTimer = new QTimer(this);
+        connect(m_reportTimer, &QTimer::timeout, this, &MorseMetrics::report);
+    }
+    m_reportTimer->setInterval(m_reportInterval);
+    m_reportTimer->start();
+}
+
+void MorseMetrics::stop()
+{
+    if (!m_reportTimer) {
+        return;
+    }
+    m_reportTimer->stop();
+}
+
+void MorseMetrics::report()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_hasUpdates) {
+        return;
+    }
+    m_hasUpdates = false;
+
+    QList<QByteArray> gaugeNames = m_gauges.keys();
+    std::sort(gaugeNames.begin(), gaugeNames.end());
+    QList<QByteArray> durationNames = m_durations.keys();
+    std::sort(durationNames.begin(), durationNames.end());
+
+    qInfo() << "Metrics:";
+    for (const QByteArray &name : gaugeNames) {
+        qInfo().nospace() << "  " << name.constData() << ": " << m_gauges.value(name);
+    }
+    for (const QByteArray &name : durationNames) {
+        const Duration duration = m_durations.value(name);
+        qInfo().nospace() << "  " << name.constData()
+                          << ": " << duration.count << " times"
+                          << ", max " << duration.maxDuration << " ms"
+                          << ", average " << (duration.count ? duration.totalDuration / duration.count : 0) << " ms";
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef MORSE_METRICS_HPP
+#define MORSE_METRICS_HPP
+
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+
+class QTimer;
+
+/**
+ * Process wide counters shared by all connections.
+ *
+ * Gauges are changed by deltas, so several connections can feed the same
+ * gauge (e.g. the total depth of the outgoing queues). Durations keep the
+ * count, the total and the maximum of the recorded values.
+ *
+ * The metrics can be updated from any thread.
+ */
+class MorseMetrics : public QObject
+{
+    Q_OBJECT
+public:
+    struct Duration
+    {
+        quint32 count = 0;
+        qint64 maxDuration = 0;
+        qint64 totalDuration = 0;
+    };
+
+    static MorseMetrics *instance();
+
+    int reportInterval() const { return m_reportInterval; }
+    void setReportInterval(int msec);
+
+    void addToGauge(const QByteArray &name, qint64 delta);
+    qint64 gauge(const QByteArray &name) const;
+
+    void recordDuration(const QByteArray &name, qint64 msec);
+    Duration duration(const QByteArray &name) const;
+
+public slots:
+    void start();
+    void stop();
+    void report();
+
+protected:
+    explicit MorseMetrics(QObject *parent = nullptr);
+
+    QTimer *m_reportTimer = nullptr;
+    int m_reportInterval = 5 * 60 * 1000;
+
+    mutable QMutex m_mutex;
+    QHash<QByteArray, qint64> m_gauges;
+    QHash<QByteArray, Duration> m_durations;
+    bool m_hasUpdates = false;
+};
+
+#endif // MORSE_METRICS_HPP
@@ -0,0 +1,480 @@
+#include "outgoingqueue.hpp"
+
+#include "clientbridge.hpp"
+#include "eventloopmonitor.hpp"
+#include "info.hpp"
+#include "metrics.hpp"
+
+#include <TelegramQt/Client>
+#include <TelegramQt/MessagingApi>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QSet>
+#include <QTimer>
+
+#include <limits>
+
+static const QString c_outgoingQueueFile = QLatin1String("outgoing-queue.bin");
+static constexpr quint32 c_outgoingQueueFormatVersion = 1;
+static constexpr int c_saveDelay = 1000; // ms, coalesces the queue file writes of a burst
+static constexpr int c_maxBackoffShift = 5; // Up to 32 send timeouts between the attempts
+static constexpr int c_minRateShift = 4; // Throttling slows a peer down to 1/16 of its rate at most
+static constexpr int c_maxPeerInFlight = 5; // Unconfirmed messages per peer, the later ones wait
+static const QByteArray c_queueDepthGauge = QByteArrayLiteral("outgoing-queue.depth");
+static const QByteArray c_queueWaitDuration = QByteArrayLiteral("outgoing-queue.wait");
+
+// Server limits: about 30 messages per second in total, one per second for a dialog and 20 per minute for a group
+static constexpr double c_defaultAccountRate = 30;
+static constexpr int c_defaultAccountBurst = 30;
+static constexpr double c_defaultPeerRate = 1;
+static constexpr int c_defaultPeerBurst = 5;
+static constexpr double c_defaultRoomRate = 20.0 / 60;
+static constexpr int c_defaultRoomBurst = 5;
+
+void MorseOutgoingQueue::RateLimit::setRate(double newRate, int newBurst)
+{
+    baseRate = newRate;
+    rate = newRate;
+    burst = qMax(1, newBurst);
+    tokens = lastUpdate ? qMin(tokens, burst) : burst;
+}
+
+qint64 MorseOutgoingQueue::RateLimit::delay(qint64 now)
+{
+    if (lastUpdate) {
+        tokens = qMin(burst, tokens + rate * (now - lastUpdate) / 1000);
+    }
+    lastUpdate = now;
+
+    if (tokens >= 1) {
+        return 0;
+    }
+    return static_cast<qint64>((1 - tokens) * 1000 / rate) + 1;
+}
+
+void MorseOutgoingQueue::RateLimit::take()
+{
+    tokens -= 1;
+}
+
+void MorseOutgoingQueue::RateLimit::throttle()
+{
+    rate = qMax(baseRate / (1 << c_minRateShift), rate / 2);
+    tokens = qMin(tokens, 0.0);
+}
+
+void MorseOutgoingQueue::RateLimit::recover()
+{
+    // Additive increase, multiplicative decrease
+    rate = qMin(baseRate, rate + baseRate / (1 << c_minRateShift));
+}
+
+MorseOutgoingQueue::MorseOutgoingQueue(MorseClientBridge *bridge, QObject *parent) :
+    QObject(parent),
+    m_bridge(bridge),
+    m_timer(new QTimer(this)),
+    m_saveTimer(new QTimer(this))
+{
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &MorseOutgoingQueue::processQueue);
+    m_saveTimer->setSingleShot(true);
+    m_saveTimer->setInterval(c_saveDelay);
+    connect(m_saveTimer, &QTimer::timeout, this, &MorseOutgoingQueue::saveData);
+
+    m_accountLimit.setRate(c_defaultAccountRate, c_defaultAccountBurst);
+    m_defaultPeerLimit.setRate(c_defaultPeerRate, c_defaultPeerBurst);
+    m_defaultRoomLimit.setRate(c_defaultRoomRate, c_defaultRoomBurst);
+}
+
+MorseOutgoingQueue::~MorseOutgoingQueue()
+{
+    if (m_saveTimer->isActive()) {
+        saveData();
+    }
+    MorseMetrics::instance()->addToGauge(c_queueDepthGauge, -m_entries.count());
+}
+
+void MorseOutgoingQueue::setInfo(MorseInfo *info)
+{
+    m_info = info;
+}
+
+quint64 MorseOutgoingQueue::reserveToken()
+{
+    // Tokens of the received messages are the message ids, so keep the local tokens far above them
+    m_lastToken = qMax(m_lastToken + 1, static_cast<quint64>(QDateTime::currentMSecsSinceEpoch()));
+    return m_lastToken;
+}
+
+quint64 MorseOutgoingQueue::enqueue(const Telegram::Peer &peer, const QString &text)
+{
+    MORSE_MONITOR_SCOPE();
+    Entry entry;
+    entry.token = reserveToken();
+    entry.peer = peer;
+    entry.text = text;
+    appendEntry(entry);
+    return entry.token;
+}
+
+void MorseOutgoingQueue::enqueueMedia(const Telegram::Peer &peer, const Telegram::MessageMediaInfo &media, quint64 token)
+{
+    MORSE_MONITOR_SCOPE();
+    Entry entry;
+    entry.token = token;
+    entry.peer = peer;
+    entry.media = media;
+    entry.hasMedia = true;
+    appendEntry(entry);
+}
+
+void MorseOutgoingQueue::appendEntry(Entry entry)
+{
+    entry.enqueueTime = QDateTime::currentMSecsSinceEpoch();
+    m_entries.append(entry);
+    MorseMetrics::instance()->addToGauge(c_queueDepthGauge, 1);
+    if (!entry.hasMedia) {
+        scheduleSave();
+    }
+
+    if (m_online) {
+        // Send from the event loop to pipeline a burst of messages
+        m_timer->start(0);
+    }
+}
+
+void MorseOutgoingQueue::setOnline(bool online)
+{
+    if (m_online == online) {
+        return;
+    }
+    m_online = online;
+    qDebug() << Q_FUNC_INFO << online << "pending messages:" << m_entries.count();
+
+    if (m_online) {
+        m_timer->start(0);
+    } else {
+        m_timer->stop();
+        if (m_saveTimer->isActive()) {
+            m_saveTimer->stop();
+            saveData();
+        }
+    }
+}
+
+void MorseOutgoingQueue::onMessageSent(const Telegram::Peer &peer, quint64 messageRandomId, quint32 messageId)
+{
+    if (m_retiredRandomIds.remove(messageRandomId)) {
+        // A late confirmation of another attempt of an already confirmed message
+        return;
+    }
+    const auto it = m_inFlight.find(messageRandomId);
+    if (it == m_inFlight.end()) {
+        // All messages are sent via the queue, so it is an attempt from before a restart
+        qDebug() << Q_FUNC_INFO << "Unknown message random id" << messageRandomId << "of" << peer.toString();
+        return;
+    }
+    const quint64 token = it.value();
+    m_inFlight.erase(it);
+
+    for (int i = 0; i < m_entries.count(); ++i) {
+        if (m_entries.at(i).token == token) {
+            removeEntry(i);
+            break;
+        }
+    }
+    peerLimit(peer).recover();
+
+    retireAttempts(token, QDateTime::currentMSecsSinceEpoch());
+    scheduleSave();
+    if (m_online) {
+        // The next message of the peer waited for this one
+        m_timer->start(0);
+    }
+
+    emit messageSent(peer, token, messageId);
+}
+
+void MorseOutgoingQueue::scheduleSave()
+{
+    // Do not restart an active timer, otherwise a long burst would postpone the save forever
+    if (!m_saveTimer->isActive()) {
+        m_saveTimer->start();
+    }
+}
+
+bool MorseOutgoingQueue::saveData() const
+{
+    MORSE_MONITOR_SCOPE();
+    if (!m_info) {
+        return false;
+    }
+
+    QDir dir;
+    dir.mkpath(m_info->accountDataDirectory());
+    QSaveFile queueFile(m_info->accountDataDirectory() + QLatin1Char('/') + c_outgoingQueueFile);
+    if (!queueFile.open(QIODevice::WriteOnly)) {
+        qWarning() << Q_FUNC_INFO << "Unable to open queue file" << queueFile.fileName();
+        return false;
+    }
+
+    // The uploaded files are referred to only for a while, so the media messages are not persistent
+    QVector<const Entry *> entries;
+    entries.reserve(m_entries.count());
+    for (const Entry &entry : m_entries) {
+        if (!entry.hasMedia) {
+            entries.append(&entry);
+        }
+    }
+
+    QDataStream stream(&queueFile);
+    stream << c_outgoingQueueFormatVersion;
+    stream << m_lastToken;
+    stream << static_cast<quint32>(entries.count());
+    for (const Entry *entry : entries) {
+        stream << entry->token;
+        stream << entry->peer.toString();
+        stream << entry->text;
+        stream << static_cast<qint32>(entry->attempts);
+    }
+
+    if (!queueFile.commit()) {
+        qWarning() << Q_FUNC_INFO << "Unable to save the outgoing messages to file" << queueFile.fileName();
+        return false;
+    }
+    return true;
+}
+
+bool MorseOutgoingQueue::loadData()
+{
+    MORSE_MONITOR_SCOPE();
+    if (!m_info) {
+        return false;
+    }
+
+    QFile queueFile(m_info->accountDataDirectory() + QLatin1Char('/') + c_outgoingQueueFile);
+    if (!queueFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&queueFile);
+    quint32 version = 0;
+    stream >> version;
+    if (version != c_outgoingQueueFormatVersion) {
+        qWarning() << Q_FUNC_INFO << "Unsupported queue format version" << version;
+        return false;
+    }
+
+    quint64 lastToken = 0;
+    quint32 count = 0;
+    stream >> lastToken;
+    stream >> count;
+
+    QVector<Entry> entries;
+    for (quint32 i = 0; (i < count) && (stream.status() == QDataStream::Ok); ++i) {
+        Entry entry;
+        QString peer;
+        qint32 attempts = 0;
+        stream >> entry.token;
+        stream >> peer;
+        stream >> entry.text;
+        stream >> attempts;
+        entry.peer = Telegram::Peer::fromString(peer);
+        entry.attempts = attempts;
+        entry.enqueueTime = QDateTime::currentMSecsSinceEpoch();
+        entries.append(entry);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << Q_FUNC_INFO << "Unable to read queue file" << queueFile.fileName();
+        return false;
+    }
+
+    m_lastToken = qMax(m_lastToken, lastToken);
+    MorseMetrics::instance()->addToGauge(c_queueDepthGauge, entries.count() - m_entries.count());
+    m_entries = entries;
+    m_inFlight.clear();
+    m_retiredRandomIds.clear();
+    qDebug() << Q_FUNC_INFO << "Loaded" << m_entries.count() << "outgoing messages";
+
+    if (m_online && !m_entries.isEmpty()) {
+        m_timer->start(0);
+    }
+    return true;
+}
+
+void MorseOutgoingQueue::processQueue()
+{
+    MORSE_MONITOR_SCOPE();
+    if (!m_online) {
+        return;
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QVector<Entry> failed;
+    QSet<Telegram::Peer> blockedPeers; // Peers with a waiting or retried message; their later messages wait too
+    QHash<Telegram::Peer, int> inFlightCounts;
+    bool changed = false;
+    m_rateLimitWakeTime = 0;
+    for (int i = 0; i < m_entries.count(); ) {
+        Entry &entry = m_entries[i];
+        if (blockedPeers.contains(entry.peer)) {
+            ++i;
+            continue;
+        }
+        if (entry.randomId) {
+            if (entry.nextAttemptTime > now) {
+                // Waiting for the confirmation
+                ++inFlightCounts[entry.peer];
+                if (entry.attempts > 1) {
+                    // A retry must not be overtaken by the later messages
+                    blockedPeers.insert(entry.peer);
+                }
+                ++i;
+                continue;
+            }
+            qWarning() << Q_FUNC_INFO << "Message" << entry.token << "is not confirmed, send it again";
+            // The message has already waited for the retry delay, so only slow the peer down
+            peerLimit(entry.peer).throttle();
+            // The random id stays mapped in case the lost attempt is confirmed late
+            entry.randomId = 0;
+        }
+        if (entry.attempts >= m_maxAttempts) {
+            qWarning() << Q_FUNC_INFO << "Give up sending message" << entry.token << "to" << entry.peer.toString();
+            retireAttempts(entry.token, now);
+            failed.append(entry);
+            removeEntry(i);
+            changed = true;
+            continue;
+        }
+
+        if (inFlightCounts.value(entry.peer) >= c_maxPeerInFlight) {
+            // The confirmations restart the processing
+            blockedPeers.insert(entry.peer);
+            ++i;
+            continue;
+        }
+
+        RateLimit &limit = peerLimit(entry.peer);
+        const qint64 accountDelay = m_accountLimit.delay(now);
+        const qint64 delay = qMax(accountDelay, limit.delay(now));
+        if (delay > 0) {
+            const qint64 wakeTime = now + delay;
+            m_rateLimitWakeTime = m_rateLimitWakeTime ? qMin(m_rateLimitWakeTime, wakeTime) : wakeTime;
+            if (accountDelay > 0) {
+                // Nothing can be sent until the account limit is refilled
+                break;
+            }
+            blockedPeers.insert(entry.peer);
+            ++i;
+            continue;
+        }
+
+        m_accountLimit.take();
+        limit.take();
+        if (!entry.attempts) {
+            MorseMetrics::instance()->recordDuration(c_queueWaitDuration, now - entry.enqueueTime);
+        }
+        send(&entry);
+        ++inFlightCounts[entry.peer];
+        if (entry.attempts > 1) {
+            blockedPeers.insert(entry.peer);
+        }
+        changed = true;
+        ++i;
+    }
+
+    if (changed) {
+        // The attempts counter is persisted to keep the limit across the restarts
+        scheduleSave();
+    }
+
+    for (const Entry &entry : failed) {
+        emit messageFailed(entry.peer, entry.token);
+    }
+
+    scheduleProcessing();
+}
+
+MorseOutgoingQueue::RateLimit &MorseOutgoingQueue::peerLimit(const Telegram::Peer &peer)
+{
+    auto it = m_peerLimits.find(peer);
+    if (it == m_peerLimits.end()) {
+        it = m_peerLimits.insert(peer, peer.type == Telegram::Peer::User ? m_defaultPeerLimit : m_defaultRoomLimit);
+    }
+    return it.value();
+}
+
+void MorseOutgoingQueue::send(Entry *entry)
+{
+    Telegram::Client::Client *client = m_bridge->client();
+    const Entry &message = *entry;
+    entry->randomId = m_bridge->call<quint64>([client, &message]() {
+        if (message.hasMedia) {
+            return client->messagingApi()->sendMedia(message.peer, message.media);
+        }
+        return client->messagingApi()->sendMessage(message.peer, message.text);
+    });
+    ++entry->attempts;
+    entry->nextAttemptTime = QDateTime::currentMSecsSinceEpoch() + retryDelay(entry->attempts);
+
+    // The previous attempts are kept mapped, because any of them can be confirmed
+    m_inFlight.insert(entry->randomId, entry->token);
+}
+
+void MorseOutgoingQueue::removeEntry(int index)
+{
+    m_entries.remove(index);
+    MorseMetrics::instance()->addToGauge(c_queueDepthGauge, -1);
+}
+
+void MorseOutgoingQueue::retireAttempts(quint64 token, qint64 now)
+{
+    // An attempt is not confirmed after the longest retry delay, so its random id is forgotten then
+    const qint64 expiredTime = now - retryDelay(c_maxBackoffShift + 1);
+    for (auto it = m_retiredRandomIds.begin(); it != m_retiredRandomIds.end(); ) {
+        if (it.value() < expiredTime) {
+            it = m_retiredRandomIds.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // The other attempts of the message can still be confirmed, so keep their random ids retired
+    for (auto attempt = m_inFlight.begin(); attempt != m_inFlight.end(); ) {
+        if (attempt.value() == token) {
+            m_retiredRandomIds.insert(attempt.key(), now);
+            attempt = m_inFlight.erase(attempt);
+        } else {
+            ++attempt;
+        }
+    }
+}
+
+int MorseOutgoingQueue::retryDelay(int attempts) const
+{
+    return m_sendTimeout << qBound(0, attempts - 1, c_maxBackoffShift);
+}
+
+void MorseOutgoingQueue::scheduleProcessing()
+{
+    if (m_entries.isEmpty()) {
+        m_timer->stop();
+        return;
+    }
+
+    qint64 nextAttemptTime = m_rateLimitWakeTime ? m_rateLimitWakeTime : std::numeric_limits<qint64>::max();
+    // The messages not sent yet wait for the rate limit only
+    for (const Entry &entry : m_entries) {
+        if (entry.randomId) {
+            nextAttemptTime = qMin(nextAttemptTime, entry.nextAttemptTime);
+        }
+    }
+    const qint64 delay = nextAttemptTime - QDateTime::currentMSecsSinceEpoch();
+    m_timer->start(static_cast<int>(qBound<qint64>(0, delay, std::numeric_limits<int>::max())));
+}
@@ -0,0 +1,127 @@
+#ifndef MORSE_OUTGOING_QUEUE_HPP
+#define MORSE_OUTGOING_QUEUE_HPP
+
+#include <QHash>
+#include <QObject>
+#include <QVector>
+
+#include <TelegramQt/TelegramNamespace>
+
+class QTimer;
+
+class MorseClientBridge;
+class MorseInfo;
+
+/**
+ * Durable queue of the outgoing messages.
+ *
+ * A message is accepted immediately with a token which stays the same
+ * for all send attempts and across the connection manager restarts.
+ * The queue is stored in the account data directory shortly after a change,
+ * so a burst of messages is written once. The media messages refer to the
+ * uploaded files and are sent via the queue too, but are not stored.
+ *
+ * The messages are sent in order of enqueue while the queue is online and
+ * kept otherwise. A message not confirmed by the server within sendTimeout()
+ * is sent again with an exponential backoff; after maxAttempts() attempts
+ * it is reported as failed and dropped.
+ *
+ * Sending is rate limited by token buckets, one for the account and one per
+ * peer (with a lower rate for group chats), to stay within the server flood
+ * limits. Up to a few messages per peer are sent without waiting for their
+ * confirmations. A message that waits for the rate limit or is sent again
+ * blocks the later messages of its peer, so they do not overtake it. An
+ * unconfirmed message is taken as a sign of flood control and halves the
+ * rate of its peer until the next confirmed messages restore it.
+ */
+class MorseOutgoingQueue : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MorseOutgoingQueue(MorseClientBridge *bridge, QObject *parent = nullptr);
+    ~MorseOutgoingQueue() override;
+
+    void setInfo(MorseInfo *info);
+
+    int sendTimeout() const { return m_sendTimeout; }
+    int maxAttempts() const { return m_maxAttempts; }
+
+    bool isOnline() const { return m_online; }
+    int pendingMessagesCount() const { return m_entries.count(); }
+
+    quint64 enqueue(const Telegram::Peer &peer, const QString &text);
+    // The token is reserved when the upload starts, so a failed upload can be reported with it
+    quint64 reserveToken();
+    void enqueueMedia(const Telegram::Peer &peer, const Telegram::MessageMediaInfo &media, quint64 token);
+
+public slots:
+    void setOnline(bool online);
+    void onMessageSent(const Telegram::Peer &peer, quint64 messageRandomId, quint32 messageId);
+
+    bool saveData() const;
+    bool loadData();
+
+signals:
+    void messageSent(const Telegram::Peer &peer, quint64 token, quint32 messageId);
+    void messageFailed(const Telegram::Peer &peer, quint64 token);
+
+protected slots:
+    void processQueue();
+
+protected:
+    struct Entry
+    {
+        quint64 token = 0;
+        Telegram::Peer peer;
+        QString text;
+        Telegram::MessageMediaInfo media;
+        bool hasMedia = false; // Sent instead of the text, not persistent
+        quint64 randomId = 0; // Random id of the attempt in flight
+        qint64 enqueueTime = 0; // msecs since epoch
+        qint64 nextAttemptTime = 0; // msecs since epoch
+        int attempts = 0;
+    };
+
+    struct RateLimit
+    {
+        double baseRate = 1;
+        double rate = 1;
+        double burst = 1;
+        double tokens = 1;
+        qint64 lastUpdate = 0;
+
+        void setRate(double newRate, int newBurst);
+        qint64 delay(qint64 now); // msecs until a message can be sent
+        void take();
+        void throttle();
+        void recover();
+    };
+
+    RateLimit &peerLimit(const Telegram::Peer &peer);
+    void appendEntry(Entry entry);
+    void send(Entry *entry);
+    void removeEntry(int index);
+    void retireAttempts(quint64 token, qint64 now);
+    int retryDelay(int attempts) const;
+    void scheduleProcessing();
+    void scheduleSave();
+
+    MorseClientBridge *m_bridge = nullptr;
+    MorseInfo *m_info = nullptr;
+    QTimer *m_timer = nullptr;
+    QTimer *m_saveTimer = nullptr;
+    QVector<Entry> m_entries; // In order of enqueue
+    QHash<quint64, quint64> m_inFlight; // Random id to token
+    QHash<quint64, qint64> m_retiredRandomIds; // Other attempts of the done messages to the retire time
+    RateLimit m_accountLimit;
+    RateLimit m_defaultPeerLimit; // Copied to the peers on first use
+    RateLimit m_defaultRoomLimit;
+    QHash<Telegram::Peer, RateLimit> m_peerLimits;
+    qint64 m_rateLimitWakeTime = 0; // msecs since epoch, 0 if nothing waits for the rate limit
+    quint64 m_lastToken = 0;
+    int m_sendTimeout = 30000; // ms
+    int m_maxAttempts = 10;
+    bool m_online = false;
+};
+
+#endif // MORSE_OUTGOING_QUEUE_HPP
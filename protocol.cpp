@@ -43,6 +43,11 @@ static const QLatin1String c_proxyUsername= QLatin1String("proxy-username");
 static const QLatin1String c_proxyPassword = QLatin1String("proxy-password");
 static const QLatin1String c_keepalive = QLatin1String("keepalive");
 static const QLatin1String c_keepaliveInterval = QLatin1String("keepalive-interval");
+static const QLatin1String c_clientThread = QLatin1String("client-thread");
+static const QLatin1String c_syncLimit = QLatin1String("sync-limit");
+static const QLatin1String c_syncWaveSize = QLatin1String("sync-wave-size");
+static const QLatin1String c_inlineThumbnails = QLatin1String("inline-thumbnails");
+static const QLatin1String c_broadcastAsContact = QLatin1String("broadcast-as-contact");
 
 MorseProtocol::MorseProtocol(const QDBusConnection &dbusConnection, const QString &name)
     : BaseProtocol(dbusConnection, name)
@@ -60,6 +65,11 @@ MorseProtocol::MorseProtocol(const QDBusConnection &dbusConnection, const QStrin
                   << Tp::ProtocolParameter(c_serverKey, QLatin1String("s"), Tp::ConnMgrParamFlagHasDefault, QString())
                   << Tp::ProtocolParameter(c_keepalive, QLatin1String("b"), Tp::ConnMgrParamFlagHasDefault, true)
                   << Tp::ProtocolParameter(c_keepaliveInterval, QLatin1String("u"), Tp::ConnMgrParamFlagHasDefault, 15)
+                  << Tp::ProtocolParameter(c_clientThread, QLatin1String("b"), Tp::ConnMgrParamFlagHasDefault, false)
+                  << Tp::ProtocolParameter(c_syncLimit, QLatin1String("u"), Tp::ConnMgrParamFlagHasDefault, 30)
+                  << Tp::ProtocolParameter(c_syncWaveSize, QLatin1String("u"), Tp::ConnMgrParamFlagHasDefault, 10)
+                  << Tp::ProtocolParameter(c_inlineThumbnails, QLatin1String("b"), Tp::ConnMgrParamFlagHasDefault, false)
+                  << Tp::ProtocolParameter(c_broadcastAsContact, QLatin1String("b"), Tp::ConnMgrParamFlagHasDefault, false)
                   << Tp::ProtocolParameter(c_proxyType, QLatin1String("s"), 0) // ATM we have only socks5 support, but Telegram supports http-proxy too
                   << Tp::ProtocolParameter(c_proxyAddress, QLatin1String("s"), 0)
                   << Tp::ProtocolParameter(c_proxyPort, QLatin1String("u"), 0)
@@ -144,11 +154,41 @@ QString MorseProtocol::getProxyPassword(const QVariantMap &parameters)
     return parameters.value(c_proxyPassword).toString();
 }
 
+bool MorseProtocol::getKeepAlive(const QVariantMap &parameters)
+{
+    return parameters.value(c_keepalive, true).toBool();
+}
+
 uint MorseProtocol::getKeepAliveInterval(const QVariantMap &parameters, uint defaultValue)
 {
     return parameters.value(c_keepaliveInterval, defaultValue).toUInt();
 }
 
+bool MorseProtocol::getEnableClientThread(const QVariantMap &parameters)
+{
+    return parameters.value(c_clientThread, false).toBool();
+}
+
+uint MorseProtocol::getSyncLimit(const QVariantMap &parameters, uint defaultValue)
+{
+    return parameters.value(c_syncLimit, defaultValue).toUInt();
+}
+
+uint MorseProtocol::getSyncWaveSize(const QVariantMap &parameters, uint defaultValue)
+{
+    return parameters.value(c_syncWaveSize, defaultValue).toUInt();
+}
+
+bool MorseProtocol::getInlineThumbnails(const QVariantMap &parameters)
+{
+    return parameters.value(c_inlineThumbnails, false).toBool();
+}
+
+bool MorseProtocol::getBroadcastAsContact(const QVariantMap &parameters)
+{
+    return parameters.value(c_broadcastAsContact, false).toBool();
+}
+
 Tp::BaseConnectionPtr MorseProtocol::createConnection(const QVariantMap &parameters, Tp::DBusError *error)
 {
     qDebug() << Q_FUNC_INFO << Telegram::Utils::maskPhoneNumber(parameters, c_account);
@@ -41,7 +41,13 @@ public:
     static quint16 getProxyPort(const QVariantMap &parameters);
     static QString getProxyUsername(const QVariantMap &parameters);
     static QString getProxyPassword(const QVariantMap &parameters);
+    static bool getKeepAlive(const QVariantMap &parameters);
     static uint getKeepAliveInterval(const QVariantMap &parameters, uint defaultValue);
+    static bool getEnableClientThread(const QVariantMap &parameters);
+    static uint getSyncLimit(const QVariantMap &parameters, uint defaultValue);
+    static uint getSyncWaveSize(const QVariantMap &parameters, uint defaultValue);
+    static bool getInlineThumbnails(const QVariantMap &parameters);
+    static bool getBroadcastAsContact(const QVariantMap &parameters);
 
 private:
     Tp::BaseConnectionPtr createConnection(const QVariantMap &parameters, Tp::DBusError *error);
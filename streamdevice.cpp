@@ -0,0 +1,116 @@
+#include "streamdevice.hpp"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QTemporaryFile>
+
+static constexpr int c_highWaterMark = 1024 * 1024; // Bytes kept in memory, the rest is spooled
+
+MorseStreamDevice::MorseStreamDevice(QObject *parent) :
+    QIODevice(parent)
+{
+}
+
+MorseStreamDevice::~MorseStreamDevice()
+{
+    delete m_spool;
+}
+
+qint64 MorseStreamDevice::bytesAvailable() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_buffer.size() - m_readPosition + (m_spoolWritePosition - m_spoolReadPosition) + QIODevice::bytesAvailable();
+}
+
+void MorseStreamDevice::finish()
+{
+    m_finished = true;
+    if (m_released) {
+        deleteLater();
+    }
+}
+
+void MorseStreamDevice::release()
+{
+    {
+        // Nobody reads the rest anymore
+        QMutexLocker locker(&m_mutex);
+        m_released = true;
+        m_buffer.clear();
+        m_readPosition = 0;
+        delete m_spool;
+        m_spool = nullptr;
+        m_spoolReadPosition = 0;
+        m_spoolWritePosition = 0;
+    }
+    if (m_finished) {
+        deleteLater();
+    }
+}
+
+qint64 MorseStreamDevice::readData(char *data, qint64 maxSize)
+{
+    QMutexLocker locker(&m_mutex);
+    qint64 count = qMin<qint64>(maxSize, m_buffer.size() - m_readPosition);
+    memcpy(data, m_buffer.constData() + m_readPosition, static_cast<size_t>(count));
+    m_readPosition += static_cast<int>(count);
+
+    // Drop the consumed data once it takes the most of the buffer
+    if (m_readPosition > m_buffer.size() / 2) {
+        m_buffer.remove(0, m_readPosition);
+        m_readPosition = 0;
+    }
+
+    // The spooled data is newer than the whole memory buffer
+    if ((count < maxSize) && (m_spoolReadPosition < m_spoolWritePosition)) {
+        m_spool->seek(m_spoolReadPosition);
+        const qint64 spooled = m_spool->read(data + count, qMin(maxSize - count, m_spoolWritePosition - m_spoolReadPosition));
+        if (spooled < 0) {
+            return count ? count : -1;
+        }
+        m_spoolReadPosition += spooled;
+        count += spooled;
+        if (m_spoolReadPosition == m_spoolWritePosition) {
+            // Drained, so the next data fits the memory again
+            m_spool->resize(0);
+            m_spoolReadPosition = 0;
+            m_spoolWritePosition = 0;
+        }
+    }
+    return count;
+}
+
+qint64 MorseStreamDevice::writeData(const char *data, qint64 size)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_released) {
+            return size;
+        }
+        // Keep the order: once spooling, the data goes to the spool until it is drained
+        const bool spool = (m_spoolReadPosition < m_spoolWritePosition)
+                || (m_buffer.size() - m_readPosition + size > c_highWaterMark);
+        if (!spool) {
+            m_buffer.append(data, static_cast<int>(size));
+        } else {
+            if (!m_spool) {
+                m_spool = new QTemporaryFile();
+                if (!m_spool->open()) {
+                    qWarning() << Q_FUNC_INFO << "Unable to open spool file" << m_spool->fileName();
+                    delete m_spool;
+                    m_spool = nullptr;
+                    return -1;
+                }
+            }
+            m_spool->seek(m_spoolWritePosition);
+            if (m_spool->write(data, size) != size) {
+                qWarning() << Q_FUNC_INFO << "Unable to write spool file" << m_spool->fileName();
+                return -1;
+            }
+            m_spoolWritePosition += size;
+        }
+    }
+    // Queued to the reader if written from the client thread
+    emit readyRead();
+    return size;
+}
@@ -0,0 +1,49 @@
+#ifndef MORSE_STREAM_DEVICE_HPP
+#define MORSE_STREAM_DEVICE_HPP
+
+#include <QIODevice>
+#include <QMutex>
+
+class QTemporaryFile;
+
+/**
+ * A sequential pipe from the Telegram client thread to the main thread.
+ *
+ * The writer (a download operation) may live in another thread; the reader
+ * gets readyRead() via a queued connection. Only the data not read yet is
+ * kept, and only up to a high-water mark in memory: the download does not
+ * wait for a slow reader, so the rest is spooled to a temporary file.
+ *
+ * The device is shared by the writer and the reader, so it is deleted once
+ * both of them are done: the writer calls finish() and the reader release(),
+ * in any order (both in the device thread).
+ */
+class MorseStreamDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit MorseStreamDevice(QObject *parent = nullptr);
+    ~MorseStreamDevice() override;
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override;
+
+public slots:
+    void finish();
+    void release();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 size) override;
+
+    mutable QMutex m_mutex;
+    QByteArray m_buffer;
+    int m_readPosition = 0;
+    QTemporaryFile *m_spool = nullptr; // Used by both threads, so it has no parent
+    qint64 m_spoolReadPosition = 0;
+    qint64 m_spoolWritePosition = 0;
+    bool m_finished = false;
+    bool m_released = false;
+};
+
+#endif // MORSE_STREAM_DEVICE_HPP
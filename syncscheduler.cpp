@@ -0,0 +1,211 @@
+#include "syncscheduler.hpp"
+
+#include "clientbridge.hpp"
+#include "eventloopmonitor.hpp"
+
+#include <TelegramQt/Client>
+#include <TelegramQt/MessagingApi>
+
+#include <QDebug>
+#include <QTimer>
+
+#include <algorithm>
+
+MorseSyncScheduler::MorseSyncScheduler(MorseClientBridge *bridge, QObject *parent) :
+    QObject(parent),
+    m_bridge(bridge),
+    m_waveTimer(new QTimer(this))
+{
+    m_waveTimer->setSingleShot(true);
+    connect(m_waveTimer, &QTimer::timeout, this, &MorseSyncScheduler::startNextWave);
+}
+
+void MorseSyncScheduler::setSyncLimit(int limit)
+{
+    m_syncLimit = qMax(1, limit);
+    m_maxSyncLimit = qMax(m_maxSyncLimit, m_syncLimit);
+}
+
+void MorseSyncScheduler::setMaxSyncLimit(int limit)
+{
+    m_maxSyncLimit = qMax(m_syncLimit, limit);
+}
+
+void MorseSyncScheduler::setWaveSize(int size)
+{
+    m_waveSize = qMax(1, size);
+}
+
+void MorseSyncScheduler::setWaveTimeout(int timeout)
+{
+    m_waveTimeout = timeout;
+}
+
+void MorseSyncScheduler::setLazySyncBudget(int budget)
+{
+    m_lazySyncBudget = qMax(1, budget);
+}
+
+void MorseSyncScheduler::schedule(const QVector<Telegram::Peer> &peers)
+{
+    MORSE_MONITOR_SCOPE();
+    QSet<Telegram::Peer> queuedPeers = m_currentWave;
+    for (const QueueEntry &entry : m_queue) {
+        queuedPeers.insert(entry.peer);
+    }
+
+    QVector<Telegram::Peer> newPeers;
+    newPeers.reserve(peers.count());
+    for (const Telegram::Peer &peer : peers) {
+        if (queuedPeers.contains(peer)) {
+            continue;
+        }
+        queuedPeers.insert(peer);
+        newPeers.append(peer);
+    }
+
+    // A single client call for all peers: each one can be a round trip to the client thread
+    const QVector<MorseClientBridge::DialogActivity> activities = m_bridge->getDialogActivities(newPeers);
+    m_queue.reserve(m_queue.count() + newPeers.count());
+    for (int i = 0; i < newPeers.count(); ++i) {
+        QueueEntry entry;
+        entry.peer = newPeers.at(i);
+        entry.unreadCount = activities.at(i).unreadCount;
+        entry.lastMessageTime = activities.at(i).lastMessageTime;
+        m_queue.append(entry);
+    }
+
+    // Keep the most important peers at the end to take them with cheap takeLast()
+    std::sort(m_queue.begin(), m_queue.end(), [](const QueueEntry &left, const QueueEntry &right) {
+        return hasHigherPriority(right, left);
+    });
+
+    qDebug() << Q_FUNC_INFO << "Peers to sync:" << m_queue.count();
+    if (m_currentWave.isEmpty()) {
+        startNextWave();
+    }
+}
+
+void MorseSyncScheduler::requestLazySync(const Telegram::Peer &peer)
+{
+    if (m_lazySynced.contains(peer) || m_lazyInFlight.contains(peer) || m_lazyQueue.contains(peer)) {
+        return;
+    }
+    m_lazyQueue.append(peer);
+    startLazySyncs();
+}
+
+void MorseSyncScheduler::resetLazySync(const Telegram::Peer &peer)
+{
+    m_lazySynced.remove(peer);
+    m_lazyQueue.removeOne(peer);
+}
+
+void MorseSyncScheduler::onPeerSynced(const Telegram::Peer &peer)
+{
+    if (m_lazyInFlight.remove(peer)) {
+        m_lazySynced.insert(peer);
+        QTimer::singleShot(0, this, &MorseSyncScheduler::startLazySyncs);
+    }
+
+    if (!m_currentWave.remove(peer)) {
+        return;
+    }
+    if (m_currentWave.isEmpty()) {
+        // Do not start the next wave from within the messages delivery
+        m_waveTimer->start(0);
+    }
+}
+
+void MorseSyncScheduler::stop()
+{
+    m_waveTimer->stop();
+    m_queue.clear();
+    m_currentWave.clear();
+    m_lazyQueue.clear();
+    m_lazyInFlight.clear();
+    m_lazySynced.clear();
+}
+
+void MorseSyncScheduler::startNextWave()
+{
+    m_waveTimer->stop();
+    if (!m_currentWave.isEmpty()) {
+        qWarning() << Q_FUNC_INFO << "Wave timed out, not synced peers:" << m_currentWave.count();
+        m_currentWave.clear();
+    }
+
+    if (m_queue.isEmpty()) {
+        emit finished();
+        return;
+    }
+
+    Telegram::PeerList wave;
+    quint32 maxUnreadCount = 0;
+    while (!m_queue.isEmpty() && (wave.count() < m_waveSize)) {
+        const QueueEntry entry = m_queue.takeLast();
+        wave.append(entry.peer);
+        m_currentWave.insert(entry.peer);
+        maxUnreadCount = qMax(maxUnreadCount, entry.unreadCount);
+    }
+
+    // The limit is shared by the whole wave, and the wave peers have similar unread counts
+    const int limit = adaptedSyncLimit(maxUnreadCount);
+    qDebug() << Q_FUNC_INFO << "Sync" << wave.count() << "peers with limit" << limit
+             << "(" << m_queue.count() << "left)";
+
+    Telegram::Client::Client *client = m_bridge->client();
+    m_bridge->post([client, wave, limit]() {
+        client->messagingApi()->setSyncLimit(limit);
+        client->messagingApi()->syncPeers(wave);
+    });
+
+    m_waveTimer->start(m_waveTimeout);
+}
+
+void MorseSyncScheduler::startLazySyncs()
+{
+    Telegram::Client::Client *client = m_bridge->client();
+    while (!m_lazyQueue.isEmpty() && (m_lazyInFlight.count() < m_lazySyncBudget)) {
+        const Telegram::Peer peer = m_lazyQueue.takeFirst();
+        const quint32 requestId = ++m_lastLazyRequestId;
+        m_lazyInFlight.insert(peer, requestId);
+
+        Telegram::DialogInfo dialogInfo;
+        m_bridge->getDialogInfo(&dialogInfo, peer);
+        const int limit = adaptedSyncLimit(dialogInfo.unreadCount());
+        qDebug() << Q_FUNC_INFO << "Lazy sync" << peer.toString() << "with limit" << limit;
+
+        m_bridge->post([client, peer, limit]() {
+            client->messagingApi()->setSyncLimit(limit);
+            client->messagingApi()->syncPeers({peer});
+        });
+        QTimer::singleShot(m_waveTimeout, this, [this, peer, requestId]() {
+            onLazySyncTimeout(peer, requestId);
+        });
+    }
+}
+
+void MorseSyncScheduler::onLazySyncTimeout(const Telegram::Peer &peer, quint32 requestId)
+{
+    if (m_lazyInFlight.value(peer) != requestId) {
+        return;
+    }
+    // Not marked as synced, so the next request retries it
+    qWarning() << Q_FUNC_INFO << "Lazy sync timed out for" << peer.toString();
+    m_lazyInFlight.remove(peer);
+    startLazySyncs();
+}
+
+int MorseSyncScheduler::adaptedSyncLimit(quint32 unreadCount) const
+{
+    return qBound(m_syncLimit, static_cast<int>(unreadCount), m_maxSyncLimit);
+}
+
+bool MorseSyncScheduler::hasHigherPriority(const QueueEntry &entry, const QueueEntry &other)
+{
+    if (entry.unreadCount != other.unreadCount) {
+        return entry.unreadCount > other.unreadCount;
+    }
+    return entry.lastMessageTime > other.lastMessageTime;
+}
@@ -0,0 +1,97 @@
+#ifndef MORSE_SYNC_SCHEDULER_HPP
+#define MORSE_SYNC_SCHEDULER_HPP
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QVector>
+
+#include <TelegramQt/TelegramNamespace>
+
+class QTimer;
+
+class MorseClientBridge;
+
+/**
+ * Syncs the dialogs history in waves.
+ *
+ * Peers with unread messages go first (the most unread ones first),
+ * then the others ordered by their last message time. Each wave syncs
+ * up to waveSize peers at once; the next wave starts once every peer of
+ * the current one has reported its messages or the wave timed out.
+ *
+ * The per-peer limit of a wave is raised up to the unread count of its
+ * peers (but not above maxSyncLimit()), so the unread backlog is fetched
+ * in one request while dormant dialogs cost only syncLimit() messages.
+ *
+ * Peers which are not worth syncing up front (group chats) are synced
+ * lazily on requestLazySync(), once per peer and with at most
+ * lazySyncBudget() lazy syncs running at the same time.
+ */
+class MorseSyncScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MorseSyncScheduler(MorseClientBridge *bridge, QObject *parent = nullptr);
+
+    int syncLimit() const { return m_syncLimit; }
+    void setSyncLimit(int limit);
+
+    int maxSyncLimit() const { return m_maxSyncLimit; }
+    void setMaxSyncLimit(int limit);
+
+    int waveSize() const { return m_waveSize; }
+    void setWaveSize(int size);
+
+    int waveTimeout() const { return m_waveTimeout; }
+    void setWaveTimeout(int timeout);
+
+    int lazySyncBudget() const { return m_lazySyncBudget; }
+    void setLazySyncBudget(int budget);
+
+    bool isActive() const { return !m_currentWave.isEmpty(); }
+    int pendingPeersCount() const { return m_queue.count(); }
+
+public slots:
+    void schedule(const QVector<Telegram::Peer> &peers);
+    void requestLazySync(const Telegram::Peer &peer);
+    void resetLazySync(const Telegram::Peer &peer);
+    void onPeerSynced(const Telegram::Peer &peer);
+    void stop();
+
+signals:
+    void finished();
+
+protected slots:
+    void startNextWave();
+    void startLazySyncs();
+
+protected:
+    struct QueueEntry
+    {
+        Telegram::Peer peer;
+        quint32 unreadCount = 0;
+        quint32 lastMessageTime = 0;
+    };
+
+    static bool hasHigherPriority(const QueueEntry &entry, const QueueEntry &other);
+    int adaptedSyncLimit(quint32 unreadCount) const;
+    void onLazySyncTimeout(const Telegram::Peer &peer, quint32 requestId);
+
+    MorseClientBridge *m_bridge = nullptr;
+    QTimer *m_waveTimer = nullptr;
+    QVector<QueueEntry> m_queue; // Sorted by priority, the next wave is at the end
+    QSet<Telegram::Peer> m_currentWave;
+    int m_syncLimit = 30;
+    int m_maxSyncLimit = 100;
+    int m_waveSize = 10;
+    int m_waveTimeout = 15000; // ms
+
+    QVector<Telegram::Peer> m_lazyQueue;
+    QHash<Telegram::Peer, quint32> m_lazyInFlight; // Peer to request id
+    QSet<Telegram::Peer> m_lazySynced;
+    quint32 m_lastLazyRequestId = 0;
+    int m_lazySyncBudget = 3;
+};
+
+#endif // MORSE_SYNC_SCHEDULER_HPP
@@ -18,7 +18,12 @@
 */
 
 #include "textchannel.hpp"
+#include "clientbridge.hpp"
 #include "connection.hpp"
+#include "contactinfo.hpp"
+#include "eventloopmonitor.hpp"
+#include "outgoingqueue.hpp"
+#include "thumbnailcache.hpp"
 
 #include <TelegramQt/Client>
 #include <TelegramQt/DataStorage>
@@ -32,35 +37,15 @@
 #include <QVariantMap>
 #include <QDateTime>
 #include <QTimer>
+#include <QUrl>
 
-QString userToVCard(const Telegram::UserInfo &userInfo)
-{
-    QStringList result;
-    result.append(QStringLiteral("BEGIN:VCARD"));
-    result.append(QStringLiteral("VERSION:4.0"));
-    QString name = userInfo.firstName() + QLatin1Char(' ') + userInfo.lastName();
-    name = name.simplified();
-    if (name.isEmpty()) {
-        return QString();
-    }
-    result.append(QStringLiteral("FN:") + name);
-    if (!userInfo.phone().isEmpty()) {
-        // TEL;VALUE=uri;TYPE=cell:tel:+33-01-23-45-67
-       result.append(QStringLiteral("TEL;PREF:tel+") + userInfo.phone());
-    }
-    // N:Family Names (surnames);Given Names;Additional Names;Honorific Prefixes;Honorific Suffixes
-    // N:Stevenson;John;Philip,Paul;Dr.;Jr.,M.D.,A.C.P.
-    // N:Smith;John;;;
-    result.append(QStringLiteral("N:") + userInfo.lastName() + QLatin1Char(';') + userInfo.firstName() + QStringLiteral(";;;"));
-    result.append(QStringLiteral("END:VCARD"));
-
-    return result.join(QStringLiteral("\r\n"));
-}
+static constexpr int c_readAckDelay = 1000; // ms, coalesces read acknowledgments of a sending burst
 
 MorseTextChannel::MorseTextChannel(MorseConnection *morseConnection, Tp::BaseChannel *baseChannel)
     : Tp::BaseChannelTextType(baseChannel),
       m_connection(morseConnection),
       m_client(morseConnection->core()),
+      m_bridge(morseConnection->bridge()),
       m_targetHandle(baseChannel->targetHandle()),
       m_targetHandleType(baseChannel->targetHandleType()),
       m_targetPeer(Telegram::Peer::fromString(baseChannel->targetID())),
@@ -68,6 +53,9 @@ MorseTextChannel::MorseTextChannel(MorseConnection *morseConnection, Tp::BaseCha
 {
     m_api = m_client->messagingApi();
     updateDialogInfo();
+    m_readAckMessageId = m_dialogInfo.readInboxMaxId();
+    // The last message can be an outgoing one, but readHistory() acks everything up to the given id
+    m_lastIncomingMessageId = m_dialogInfo.unreadCount() ? m_dialogInfo.lastMessageId() : m_readAckMessageId;
 
     QStringList supportedContentTypes = QStringList()
             << QLatin1String("text/plain")
@@ -77,7 +65,7 @@ MorseTextChannel::MorseTextChannel(MorseConnection *morseConnection, Tp::BaseCha
     Tp::UIntList messageTypes = Tp::UIntList() << Tp::ChannelTextMessageTypeNormal << Tp::ChannelTextMessageTypeDeliveryReport;
 
     uint messagePartSupportFlags = 0;
-    uint deliveryReportingSupport = Tp::DeliveryReportingSupportFlagReceiveSuccesses|Tp::DeliveryReportingSupportFlagReceiveRead;
+    uint deliveryReportingSupport = Tp::DeliveryReportingSupportFlagReceiveFailures|Tp::DeliveryReportingSupportFlagReceiveSuccesses|Tp::DeliveryReportingSupportFlagReceiveRead;
 
     setMessageAcknowledgedCallback(Tp::memFun(this, &MorseTextChannel::messageAcknowledgedCallback));
 
@@ -94,12 +82,9 @@ MorseTextChannel::MorseTextChannel(MorseConnection *morseConnection, Tp::BaseCha
     m_chatStateIface->setSetChatStateCallback(Tp::memFun(this, &MorseTextChannel::setChatState));
     baseChannel->plugInterface(Tp::AbstractChannelInterfacePtr::dynamicCast(m_chatStateIface));
 
-    connect(m_api, &Telegram::Client::MessagingApi::messageActionChanged,
-            this, &MorseTextChannel::onMessageActionChanged);
-
     Telegram::ChatInfo info;
     if (m_targetPeer.type != Telegram::Peer::User) {
-        m_client->dataStorage()->getChatInfo(&info, m_targetPeer);
+        m_bridge->getChatInfo(&info, m_targetPeer);
     }
     m_broadcast = info.broadcast();
 
@@ -146,7 +131,9 @@ MorseTextChannel::~MorseTextChannel()
 
 QString MorseTextChannel::sendMessageCallback(const Tp::MessagePartList &messageParts, uint flags, Tp::DBusError *error)
 {
-    m_api->readHistory(m_targetPeer, m_dialogInfo.lastMessageId());
+    MORSE_MONITOR_SCOPE();
+    // Replying implies that the user has read the dialog
+    scheduleReadAck();
 
     QString content;
     for (const Tp::MessagePart &part : messageParts) {
@@ -158,9 +145,10 @@ QString MorseTextChannel::sendMessageCallback(const Tp::MessagePartList &message
         }
     }
 
-    quint64 tmpId = m_api->sendMessage(m_targetPeer, content);
+    // Accepted even while offline; the delivery is reported via onMessageSent()
+    const quint64 token = m_connection->outgoingQueue()->enqueue(m_targetPeer, content);
 
-    return QString::number(tmpId);
+    return QString::number(token);
 }
 
 void MorseTextChannel::messageAcknowledgedCallback(const QString &messageId)
@@ -177,16 +165,6 @@ QString MorseTextChannel::getMessageToken(quint32 messageId) const
     return token;
 }
 
-void MorseTextChannel::onMessageActionChanged(const Telegram::Peer &peer, quint32 userId, const Telegram::MessageAction &action)
-{
-    // We are connected to broadcast signal, so have to select only needed calls
-    const Telegram::Peer identifier = peer;
-    if (identifier != m_targetPeer) {
-        return;
-    }
-    setMessageAction(userId, action);
-}
-
 void MorseTextChannel::setMessageAction(quint32 userId, const Telegram::MessageAction &action)
 {
     const uint handle = m_connection->ensureContact(userId);
@@ -203,7 +181,11 @@ void MorseTextChannel::setMessageAction(quint32 userId, const Telegram::MessageA
 
 void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
 {
+    MORSE_MONITOR_SCOPE();
     updateDialogInfo();
+    if (!(message.flags() & Telegram::Namespace::MessageFlagOut)) {
+        m_lastIncomingMessageId = qMax(m_lastIncomingMessageId, message.id());
+    }
 
     Tp::MessagePartList partList;
     Tp::MessagePart header;
@@ -223,6 +205,7 @@ void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
 
     const bool isOut = message.flags() & Telegram::Namespace::MessageFlagOut;
     const bool toSelf = message.peer() == m_connection->selfPeer();
+    const Telegram::Peer senderPeer = Telegram::Peer::fromUserId(message.fromUserId());
 
     if (m_broadcast) {
         header[QLatin1String("message-sender")]    = QDBusVariant(m_targetHandle);
@@ -231,9 +214,8 @@ void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
         header[QLatin1String("message-sender")]    = QDBusVariant(m_connection->selfHandle());
         header[QLatin1String("message-sender-id")] = QDBusVariant(m_connection->selfID());
     } else {
-        const Telegram::Peer senderId = Telegram::Peer::fromUserId(message.fromUserId());
-        header[QLatin1String("message-sender")]    = QDBusVariant(m_connection->ensureHandle(senderId));
-        header[QLatin1String("message-sender-id")] = QDBusVariant(senderId.toString());
+        header[QLatin1String("message-sender")]    = QDBusVariant(m_connection->ensureHandle(senderPeer));
+        header[QLatin1String("message-sender-id")] = QDBusVariant(senderPeer.toString());
     }
 
     const bool isRead = toSelf
@@ -286,9 +268,10 @@ void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
 
     if (message.type() != Telegram::Namespace::MessageTypeText) { // More, than a plain text message
         Telegram::MessageMediaInfo info;
-        m_client->dataStorage()->getMessageMediaInfo(&info, message.peer(), message.id());
+        m_bridge->getMessageMediaInfo(&info, message.peer(), message.id());
 
         bool handled = true;
+        bool offered = false; // As an incoming file transfer
         switch (message.type()) {
         case Telegram::Namespace::MessageTypeGeo: {
             static const QString jsonTemplate = QLatin1String("{\"type\":\"point\",\"coordinates\":[%1, %2]}");
@@ -306,7 +289,7 @@ void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
                 break;
             }
 
-            QString data = userToVCard(userInfo);
+            const QString data = MorseContactInfoCache::renderVCard(userInfo);
             if (data.isEmpty()) {
                 qWarning() << Q_FUNC_INFO << "Unable to get user vcard from user info from message" << message.id();
                 break;
@@ -330,6 +313,16 @@ void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
             body << webPart;
         }
             break;
+        case Telegram::Namespace::MessageTypePhoto:
+        case Telegram::Namespace::MessageTypeDocument:
+        case Telegram::Namespace::MessageTypeVideo:
+        case Telegram::Namespace::MessageTypeAudio:
+            // The file is downloaded only if the client accepts the transfer,
+            // so do not offer the files of the history messages.
+            offered = !silent && !isOut && !m_broadcast
+                    && m_connection->offerFile(senderPeer, info, message.type(), message.timestamp());
+            handled = offered;
+            break;
         default:
             handled = false;
             break;
@@ -341,7 +334,17 @@ void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
             thumbnailMessage[QLatin1String("content-type")] = QDBusVariant(QLatin1String("image/jpeg"));
             thumbnailMessage[QLatin1String("alternative")] = QDBusVariant(QLatin1String("multimedia"));
             thumbnailMessage[QLatin1String("thumbnail")] = QDBusVariant(true);
-            thumbnailMessage[QLatin1String("content")] = QDBusVariant(cachedContent);
+            thumbnailMessage[QLatin1String("size")] = QDBusVariant(static_cast<uint>(cachedContent.size()));
+
+            // Refer to the cached file unless the client asked for the image bytes in the message
+            const QString cachedFile = m_connection->inlineThumbnails()
+                    ? QString()
+                    : MorseThumbnailCache::instance()->store(cachedContent, QStringLiteral("jpg"));
+            if (cachedFile.isEmpty()) {
+                thumbnailMessage[QLatin1String("content")] = QDBusVariant(cachedContent);
+            } else {
+                thumbnailMessage[QLatin1String("uri")] = QDBusVariant(QUrl::fromLocalFile(cachedFile).toString());
+            }
             body << thumbnailMessage;
         }
 
@@ -352,7 +355,8 @@ void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
         if (info.alt().isEmpty()) {
             const QString notHandledText = tr("Telepathy-Morse doesn't support this type of multimedia messages yet.");
             const QString badAlternativeText = tr("Telepathy client doesn't support this type of multimedia messages.");
-            const QString notSupportedText = handled ? badAlternativeText : notHandledText;
+            const QString offeredText = tr("The file is offered as a file transfer.");
+            const QString notSupportedText = offered ? offeredText : (handled ? badAlternativeText : notHandledText);
             if (body.isEmpty()) {// There is no text part
                 textMessage[QLatin1String("content")] = QDBusVariant(notSupportedText);
             } else { // There is a text part, so we need to add the notSupportedText on a new line
@@ -383,6 +387,7 @@ void MorseTextChannel::onMessageReceived(const Telegram::Message &message)
 void MorseTextChannel::updateChatParticipants(const Tp::UIntList &handles)
 {
 #ifdef ENABLE_GROUP_CHAT
+    m_memberHandles = handles;
     m_groupIface->setMembers(handles, /* details */ QVariantMap());
 #else
     Q_UNUSED(handles)
@@ -397,19 +402,39 @@ void MorseTextChannel::onChatDetailsChanged(quint32 chatId, const Tp::UIntList &
         updateChatParticipants(handles);
 
         Telegram::ChatInfo info;
-        if (m_client->dataStorage()->getChatInfo(&info, chatId)) {
+        if (m_bridge->getChatInfo(&info, m_targetPeer)) {
             m_roomConfigIface->setTitle(info.title());
             m_roomConfigIface->setConfigurationRetrieved(true);
         }
     }
 }
 
-void MorseTextChannel::setMessageInboxRead(Telegram::Peer peer, quint32 messageId)
+QSet<uint> MorseTextChannel::referencedHandles()
 {
-    // We are connected to broadcast signal, so have to select only needed calls
-    if (m_targetPeer != peer) {
-        return;
+    QSet<uint> handles;
+    handles.reserve(m_memberHandles.count());
+    for (const uint handle : m_memberHandles) {
+        handles.insert(handle);
     }
+    // The header and the forwarding header both refer to a sender
+    foreach (const Tp::MessagePartList &message, pendingMessages()) {
+        for (const Tp::MessagePart &part : message) {
+            const auto it = part.constFind(QLatin1String("message-sender"));
+            if (it != part.constEnd()) {
+                handles.insert(it.value().variant().toUInt());
+            }
+        }
+    }
+    return handles;
+}
+
+void MorseTextChannel::setMessageInboxRead(Telegram::Peer peer, quint32 messageId)
+{
+    // Routed by MorseConnection, so the peer is always the target one
+    Q_ASSERT(m_targetPeer == peer);
+
+    // Read on the server already (e.g. from another device), no need to acknowledge it again
+    m_readAckMessageId = qMax(m_readAckMessageId, messageId);
 
     // TODO: Mark *all* messages up to this as read
     QStringList tokens;
@@ -441,10 +466,8 @@ void MorseTextChannel::setMessageInboxRead(Telegram::Peer peer, quint32 messageI
 
 void MorseTextChannel::setMessageOutboxRead(Telegram::Peer peer, quint32 messageId)
 {
-    // We are connected to broadcast signal, so have to select only needed calls
-    if (m_targetPeer != peer) {
-        return;
-    }
+    // Routed by MorseConnection, so the peer is always the target one
+    Q_ASSERT(m_targetPeer == peer);
 
     // TODO: Mark *all* messages up to this as read
 
@@ -465,14 +488,14 @@ void MorseTextChannel::setMessageOutboxRead(Telegram::Peer peer, quint32 message
 
 void MorseTextChannel::updateDialogInfo()
 {
-    m_client->dataStorage()->getDialogInfo(&m_dialogInfo, m_targetPeer);
+    m_bridge->getDialogInfo(&m_dialogInfo, m_targetPeer);
 }
 
-void MorseTextChannel::onMessageSent(quint64 messageRandomId, quint32 messageId)
+void MorseTextChannel::onMessageSent(quint64 messageToken, quint32 messageId)
 {
     Q_UNUSED(messageId)
 
-    const QString token = QString::number(messageRandomId);
+    const QString token = QString::number(messageToken);
 
     Tp::MessagePartList partList;
 
@@ -487,9 +510,66 @@ void MorseTextChannel::onMessageSent(quint64 messageRandomId, quint32 messageId)
     addReceivedMessage(partList);
 }
 
+void MorseTextChannel::onMessageFailed(quint64 messageToken)
+{
+    const QString token = QString::number(messageToken);
+
+    Tp::MessagePartList partList;
+
+    Tp::MessagePart header;
+    header[QLatin1String("message-sender")]    = QDBusVariant(m_targetHandle);
+    header[QLatin1String("message-sender-id")] = QDBusVariant(m_targetPeer.toString());
+    header[QLatin1String("message-type")]      = QDBusVariant(Tp::ChannelTextMessageTypeDeliveryReport);
+    header[QLatin1String("delivery-status")]   = QDBusVariant(Tp::DeliveryStatusPermanentlyFailed);
+    header[QLatin1String("delivery-token")]    = QDBusVariant(token);
+    partList << header;
+
+    addReceivedMessage(partList);
+}
+
+void MorseTextChannel::scheduleReadAck()
+{
+    // Own messages do not need an ack, so sending alone does not cost a readHistory() call
+    if (m_lastIncomingMessageId <= m_readAckMessageId) {
+        return;
+    }
+
+    if (!m_readAckTimer) {
+        m_readAckTimer = new QTimer(this);
+        m_readAckTimer->setSingleShot(true);
+        m_readAckTimer->setInterval(c_readAckDelay);
+        connect(m_readAckTimer, &QTimer::timeout, this, &MorseTextChannel::sendReadAck);
+    }
+
+    // Do not restart an active timer, otherwise a long burst would postpone the ack forever
+    if (!m_readAckTimer->isActive()) {
+        m_readAckTimer->start();
+    }
+}
+
+void MorseTextChannel::sendReadAck()
+{
+    const quint32 lastMessageId = m_lastIncomingMessageId;
+    if (lastMessageId <= m_readAckMessageId) {
+        return;
+    }
+    m_readAckMessageId = lastMessageId;
+
+    // The channel can be closed before the posted calls are executed, so capture values instead of this
+    Telegram::Client::MessagingApi *api = m_api;
+    const Telegram::Peer peer = m_targetPeer;
+    m_bridge->post([api, peer, lastMessageId]() {
+        api->readHistory(peer, lastMessageId);
+    });
+}
+
 void MorseTextChannel::reactivateLocalTyping()
 {
-    m_api->setMessageAction(m_targetPeer, Telegram::MessageAction::Typing);
+    Telegram::Client::MessagingApi *api = m_api;
+    const Telegram::Peer peer = m_targetPeer;
+    m_bridge->post([api, peer]() {
+        api->setMessageAction(peer, Telegram::MessageAction::Typing);
+    });
 }
 
 void MorseTextChannel::setChatState(uint state, Tp::DBusError *error)
@@ -506,7 +586,11 @@ void MorseTextChannel::setChatState(uint state, Tp::DBusError *error)
         reactivateLocalTyping();
         m_localTypingTimer->start();
     } else {
-        m_api->setMessageAction(m_targetPeer, Telegram::MessageAction::None);
+        Telegram::Client::MessagingApi *api = m_api;
+        const Telegram::Peer peer = m_targetPeer;
+        m_bridge->post([api, peer]() {
+            api->setMessageAction(peer, Telegram::MessageAction::None);
+        });
         m_localTypingTimer->stop();
     }
 }
@@ -21,6 +21,7 @@
 #define MORSE_TEXTCHANNEL_HPP
 
 #include <QPointer>
+#include <QSet>
 
 #include <TelegramQt/TelegramNamespace>
 
@@ -31,6 +32,7 @@ class QTimer;
 class CTelegramCore;
 
 class MorseTextChannel;
+class MorseClientBridge;
 class MorseConnection;
 
 namespace Telegram {
@@ -59,22 +61,27 @@ public:
 
     QString getMessageToken(quint32 messageId) const;
 
+    // The contact handles the clients can still hold via this channel: members and pending message senders
+    QSet<uint> referencedHandles();
+
 public slots:
-    void onMessageActionChanged(const Telegram::Peer &peer, quint32 userId, const Telegram::MessageAction &action);
     void setMessageAction(quint32 userId, const Telegram::MessageAction &action);
     void onMessageReceived(const Telegram::Message &message);
-    void onMessageSent(quint64 messageRandomId, quint32 messageId);
+    void onMessageSent(quint64 messageToken, quint32 messageId);
+    void onMessageFailed(quint64 messageToken);
     void updateChatParticipants(const Tp::UIntList &handles);
 
     void onChatDetailsChanged(quint32 chatId, const Tp::UIntList &handles);
-
-protected slots:
     void setMessageInboxRead(Telegram::Peer peer, quint32 messageId);
     void setMessageOutboxRead(Telegram::Peer peer, quint32 messageId);
+
+protected slots:
     void updateDialogInfo();
+    void sendReadAck();
     void reactivateLocalTyping();
 
 protected:
+    void scheduleReadAck();
     void setChatState(uint state, Tp::DBusError *error);
 
 private:
@@ -83,11 +90,14 @@ private:
     MorseConnection *m_connection;
     Telegram::Client::Client *m_client;
     Telegram::Client::MessagingApi *m_api = nullptr;
+    MorseClientBridge *m_bridge = nullptr;
 
     uint m_targetHandle;
     uint m_targetHandleType;
     Telegram::Peer m_targetPeer;
     Telegram::DialogInfo m_dialogInfo;
+    quint32 m_readAckMessageId = 0; // The last message id marked as read on the server
+    quint32 m_lastIncomingMessageId = 0;
     bool m_broadcast = false;
 
     Tp::BaseChannelTextTypePtr m_channelTextType;
@@ -98,6 +108,8 @@ private:
     Tp::BaseChannelRoomConfigInterfacePtr m_roomConfigIface;
 
     QTimer *m_localTypingTimer;
+    QTimer *m_readAckTimer = nullptr;
+    Tp::UIntList m_memberHandles;
 
 };
 
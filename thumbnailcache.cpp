@@ -0,0 +1,128 @@
+#include "thumbnailcache.hpp"
+
+#include "eventloopmonitor.hpp"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <utime.h>
+
+static constexpr int c_maxFileAge = 30; // Days
+static constexpr qint64 c_maxCacheSize = 100 * 1024 * 1024; // Bytes
+static constexpr qint64 c_prunedCacheSize = c_maxCacheSize * 3 / 4; // Bytes, to not prune on each store at the limit
+static constexpr qint64 c_pruneInterval = 24 * 60 * 60 * 1000; // ms
+static constexpr qint64 c_touchInterval = 24 * 60 * 60 * 1000; // ms, the use time is precise enough for the age limit
+static constexpr int c_maxStoredFiles = 10000; // Known files, the others are checked on disk
+
+static MorseThumbnailCache *s_instance = nullptr;
+
+MorseThumbnailCache::MorseThumbnailCache(QObject *parent) :
+    QObject(parent),
+    m_directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/thumbnails"))
+{
+}
+
+MorseThumbnailCache *MorseThumbnailCache::instance()
+{
+    if (!s_instance) {
+        s_instance = new MorseThumbnailCache(QCoreApplication::instance());
+    }
+    return s_instance;
+}
+
+void MorseThumbnailCache::setDirectory(const QString &directory)
+{
+    m_directory = directory;
+    m_storedFiles.clear();
+    m_cacheSize = 0;
+    m_pruneTime = 0;
+}
+
+void MorseThumbnailCache::prune()
+{
+    MORSE_MONITOR_SCOPE();
+    // The most recently used first, so the files over the size limit are the least recently used ones
+    const QFileInfoList files = QDir(m_directory).entryInfoList(QDir::Files, QDir::Time);
+    const QDateTime oldestTime = QDateTime::currentDateTime().addDays(-c_maxFileAge);
+    const qint64 sizeLimit = m_cacheSize > c_maxCacheSize ? c_prunedCacheSize : c_maxCacheSize;
+    qint64 cacheSize = 0;
+    bool full = false;
+    int removedCount = 0;
+    for (const QFileInfo &file : files) {
+        full = full || (cacheSize + file.size() > sizeLimit);
+        if (!full && (file.lastModified() >= oldestTime)) {
+            cacheSize += file.size();
+            continue;
+        }
+        if (QFile::remove(file.filePath())) {
+            m_storedFiles.remove(file.filePath());
+            ++removedCount;
+        } else {
+            cacheSize += file.size();
+        }
+    }
+    m_cacheSize = cacheSize;
+    m_pruneTime = QDateTime::currentMSecsSinceEpoch();
+    if (removedCount) {
+        qDebug() << Q_FUNC_INFO << "Removed" << removedCount << "of" << files.count() << "thumbnails";
+    }
+}
+
+QString MorseThumbnailCache::store(const QByteArray &data, const QString &suffix)
+{
+    MORSE_MONITOR_SCOPE();
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (!m_pruneTime || (now - m_pruneTime > c_pruneInterval) || (m_cacheSize > c_maxCacheSize)) {
+        prune();
+    }
+
+    const QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+    const QString filePath = m_directory + QLatin1Char('/') + QLatin1String(hash) + QLatin1Char('.') + suffix;
+    const auto it = m_storedFiles.constFind(filePath);
+    if (it != m_storedFiles.constEnd()) {
+        touch(filePath, it.value());
+        return filePath;
+    }
+
+    // The same content always gets the same name, so an existing file is already complete
+    const QFileInfo existingFile(filePath);
+    qint64 lastUsed = now;
+    if (existingFile.exists()) {
+        lastUsed = existingFile.lastModified().toMSecsSinceEpoch();
+    } else {
+        QDir().mkpath(m_directory);
+        QSaveFile file(filePath);
+        if (!file.open(QIODevice::WriteOnly) || (file.write(data) != data.size()) || !file.commit()) {
+            qWarning() << Q_FUNC_INFO << "Unable to write thumbnail file" << filePath;
+            return QString();
+        }
+        m_cacheSize += data.size();
+    }
+
+    if (m_storedFiles.count() >= c_maxStoredFiles) {
+        m_storedFiles.clear();
+    }
+    m_storedFiles.insert(filePath, lastUsed);
+    touch(filePath, lastUsed);
+    return filePath;
+}
+
+void MorseThumbnailCache::touch(const QString &filePath, qint64 lastUsed)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - lastUsed < c_touchInterval) {
+        return;
+    }
+    // Keep the reused files from being pruned as the old ones
+    if (::utime(QFile::encodeName(filePath).constData(), nullptr) != 0) {
+        qWarning() << Q_FUNC_INFO << "Unable to update the time of thumbnail file" << filePath;
+    }
+    m_storedFiles[filePath] = now;
+}
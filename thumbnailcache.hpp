@@ -0,0 +1,43 @@
+#ifndef MORSE_THUMBNAIL_CACHE_HPP
+#define MORSE_THUMBNAIL_CACHE_HPP
+
+#include <QHash>
+#include <QObject>
+
+/**
+ * Content-addressed storage of the message thumbnails.
+ *
+ * Each thumbnail is written once to a file named after the hash of its data,
+ * so the messages (including the scrollback replays) can refer to the file
+ * instead of carrying the image bytes through D-Bus. A reused file gets its
+ * modification time updated, so the files not used for a month or over the
+ * size limit (the least recently used first) are removed. The cache is pruned
+ * before the first store, daily and whenever it grows over the size limit.
+ * The cache is shared by all connections and is supposed to be used from the
+ * main thread only.
+ */
+class MorseThumbnailCache : public QObject
+{
+    Q_OBJECT
+public:
+    static MorseThumbnailCache *instance();
+
+    QString directory() const { return m_directory; }
+    void setDirectory(const QString &directory);
+
+    // Returns the path to the file with the data or an empty string on failure
+    QString store(const QByteArray &data, const QString &suffix);
+
+protected:
+    explicit MorseThumbnailCache(QObject *parent = nullptr);
+    void prune();
+    void touch(const QString &filePath, qint64 lastUsed);
+
+    QString m_directory;
+    // Known to be on disk, so there is no need to check them again; to the last use time
+    QHash<QString, qint64> m_storedFiles;
+    qint64 m_cacheSize = 0; // Bytes, since the last prune
+    qint64 m_pruneTime = 0; // msecs since epoch, 0 if not pruned yet
+};
+
+#endif // MORSE_THUMBNAIL_CACHE_HPP